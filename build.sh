@@ -1,11 +1,14 @@
 #!/bin/sh
-cflags="-march=native -std=c99 -Wall -Wextra -fno-builtin -static"
+# NOTE: built for the base instruction set; wider vector kernels are picked at
+# runtime (simd.c). "native" tunes everything else for the build host
+cflags="-std=c99 -Wall -Wextra -fno-builtin -static"
 #cflags="${cflags} -fproc-stat-report"
 #cflags="${cflags} -Rpass-missed=.*"
 #cflags="${cflags} -fsanitize=address,undefined"
 
 cc=${CC:-cc}
 build=release
+embed=
 
 for arg in "$@"; do
 	case "$arg" in
@@ -13,30 +16,48 @@ for arg in "$@"; do
 	gcc)     cc=gcc        ;;
 	debug)   build=debug   ;;
 	release) build=release ;;
-	*) echo "usage: $0 [debug|release] [gcc|clang]" ;;
+	native)  cflags="${cflags} -march=native" ;;
+	embed)   embed=1       ;;
+	yomigen) build=yomigen ;;
+	*) echo "usage: $0 [debug|release|yomigen] [native] [embed] [gcc|clang]" ;;
 	esac
 done
 
 case "${build}" in
 debug)   cflags="${cflags} -O0 -ggdb -D_DEBUG" ;;
 release) cflags="${cflags} -O3 -s" ;;
+yomigen)
+	# NOTE(rnp): synthetic dictionary generator for benchmarks; hosted build
+	${cc} -O3 -std=c99 -Wall -Wextra yomigen.c -o yomigen
+	exit $?
+	;;
 esac
 
 src=platform_posix.c
+ldflags="-pthread"
 
 case $(uname -sm) in
 "Linux aarch64")
 	src=platform_linux_aarch64.c
+	ldflags=""
 	cflags="${cflags} -nostdlib -ffreestanding -fno-stack-protector -Wl,--gc-sections"
 	;;
 "Linux x86_64")
 	src=platform_linux_amd64.c
+	ldflags=""
 	cflags="${cflags} -nostdinc -nostdlib -ffreestanding -fno-stack-protector -Wl,--gc-sections"
 	;;
 esac
 
 ${cc} ${cflags} ${ldflags} $src -o jdict
 
+# NOTE: "embed" links an image of the dictionaries in config.h, written by the
+# binary just built, into the final binary; it never reads the term banks
+if [ "${embed}" ]; then
+	./jdict --write-image jdict.img || exit 1
+	${cc} ${cflags} -DEMBED_IMAGE=\"jdict.img\" ${ldflags} $src -o jdict || exit 1
+fi
+
 # NOTE(rnp): cross compile tests
 clang --target=x86_64-unknown-linux-musl  -O3 -nostdlib -ffreestanding -fno-stack-protector \
 	-Wl,--gc-sections platform_linux_amd64.c -o /dev/null
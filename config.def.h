@@ -3,6 +3,14 @@
 /* dir where unzipped yomidicts are stored */
 static s8 prefix = s8("/usr/share/yomidicts");
 
+/* dir where parsed dictionaries are shared between jdict processes;
+ * set to s8("") to always parse the term banks */
+static s8 image_dir = s8("/dev/shm");
+
+/* most memory that may be mapped for parsing and lookups (see --memory);
+ * 0 places no limit */
+static size arena_budget = 0;
+
 /* field separator for output printing */
 static s8 fsep = s8("\t");
 
@@ -10,7 +18,8 @@ static s8 fsep = s8("\t");
 static s8 repl_prompt = s8("\033[32;1m入力:\033[0m ");
 static s8 repl_quit   = s8("\n\033[36m(=^ᆺ^)ﾉ　バイバイ～\033[0m");
 
-/* default yomidicts to search */
+/* default yomidicts to search; names ending in .zip are read from the
+ * archive created by yomichan-import without extracting it */
 Dict default_dict_map[] = {
 	/* folder name           display name */
 	{.rom = s8("daijirin"),  .name = s8("【三省堂　スーパー大辞林】")},
@@ -27,78 +27,543 @@
 #endif
 
 #define ARRAY_COUNT(a) (sizeof(a) / sizeof(*a))
+#define MIN(a, b)      ((a) < (b) ? (a) : (b))
 #define ISSPACE(c)     ((c) == ' ' || (c) == '\n' || (c) == '\t')
+#define ISHEX(c)       (((c) >= '0' && (c) <= '9') || (((c) | 0x20) >= 'a' && ((c) | 0x20) <= 'f'))
 
 #define MEGABYTE (1024ULL * 1024ULL)
 
+/* alignment requested for the arena so that it can be backed by huge pages */
+#define HUGEPAGE_SIZE (2 * MEGABYTE)
+
 typedef struct {
 	size len;
 	u8   *s;
 } s8;
 #define s8(cstr) (s8){.len = ARRAY_COUNT(cstr) - 1, .s = (u8 *)cstr}
 
+/* NOTE: same layout as struct iovec */
+typedef struct {
+	void  *base;
+	usize  len;
+} IOVec;
+
+/* NOTE: when iov is set strings appended with stream_append_ref() are
+ * gathered by reference instead of being copied into data; data[mark..widx]
+ * holds the bytes buffered since the last reference */
 typedef struct {
-	u8   *data;
-	u32   cap;
-	u32   widx;
-	i32   fd;
-	b32   errors;
+	u8    *data;
+	u32    cap;
+	u32    widx;
+	i32    fd;
+	b32    errors;
+	IOVec *iov;
+	u32    iov_cap;
+	u32    iov_len;
+	u32    mark;
+	size   gathered;
 } Stream;
 
+typedef struct ArenaBlock {
+	struct ArenaBlock *prev;
+	size               size;
+} ArenaBlock;
+
+/* NOTE: an arena is a chain of blocks; when the current block runs out a new
+ * one is mapped and the unused tail of the old one is abandoned */
 typedef struct {
 	u8 *beg, *end;
-#ifdef _DEBUG_ARENA
-	size min_capacity_remaining;
-#endif
+	ArenaBlock *block;
 } Arena;
 
+#define TRACE_DETAIL_LEN 46
+
+typedef struct {
+	s8  name;
+	u64 begin, end;
+	u32 tid;
+	u16 detail_len;
+	u8  detail[TRACE_DETAIL_LEN];
+} TraceEvent;
+
+/* NOTE: ring buffer of completed zones; oldest events are overwritten */
+typedef struct {
+	TraceEvent *events;
+	u32         cap;
+	u32         count;
+	u64         timer_base;
+} Trace;
+
+typedef struct {
+	s8  name;
+	s8  detail;
+	u64 begin;
+	u32 tid;
+} TraceZone;
+
+/* NOTE: last bucket counts all probe sequences of at least that length */
+#define STATS_PROBE_BUCKETS 16
+
+/* always compiled counters; dumped with --stats or the repl stats command */
+typedef struct {
+	u64  tokens_scanned;
+	u64  entries_interned;
+	u64  intern_collisions;
+	u64  table_grows;
+	u64  intern_probes[STATS_PROBE_BUCKETS];
+	u64  find_calls;
+	u64  find_collisions;
+	u64  find_probes[STATS_PROBE_BUCKETS];
+	u64  bytes_read;
+	u64  bytes_inflated;
+	u64  syscalls;
+	u64  stream_flushes;
+	u64  bytes_gathered;
+	u64  banks_parsed;
+	u64  banks_reused;
+	u64  result_cache_hits;
+	u64  result_cache_misses;
+	u64  result_cache_evictions;
+	size arena_capacity;
+	size arena_peak;
+} Stats;
+
+#include "simd.c"
 #include "yomidict.c"
+#include "zip.c"
+#include "normalize.c"
+#include "suffix.c"
+
+/* Initial guess at the density of tokens in a term bank; the token array is
+ * doubled and the bank lexed again if it was too low */
+#define YOMI_BYTES_PER_TOK 16
 
-#define YOMI_TOKS_PER_ENT 10
+/* Smallest block mapped for an arena; larger allocations get a block of their own */
+#define ARENA_BLOCK_SIZE (16 * MEGABYTE)
 
-/* Number of hash table slots (1 << HT_EXP) */
+/* NOTE: output is submitted once either limit is reached; IOV_MAX is 1024 */
+#define STREAM_IOV_MAX    1024
+#define STREAM_GATHER_MAX (size)(8 * MEGABYTE)
+#define STREAM_REF_MIN    64
+
+/* NOTE: number of lookups whose memory accesses are interleaved */
+#define LOOKUP_GROUP 16
+
+/* Initial number of hash table slots (1 << HT_EXP); tables double when half full */
 #define HT_EXP 20
 
+/* Number of term banks read ahead of the one being parsed and the largest
+ * bank that will be read ahead; larger banks are read when they are needed */
+#define READ_AHEAD_DEPTH     4
+#define READ_AHEAD_SLOT_SIZE (16 * MEGABYTE)
+
+/* Number of trace events kept when tracing (must be a power of 2) */
+#define TRACE_EVENTS (1 << 16)
+
+/* Code points per page of the kanji index (1 << KANJI_PAGE_BITS) and the
+ * largest code point it holds */
+#define KANJI_PAGE_BITS     8
+#define KANJI_CODEPOINT_MAX 0x3FFFF
+
+/* Longest term in code points that can be a segment (-a) and the number of
+ * lattice edges collected before their terms are looked up */
+#define SEGMENT_MAX_CHARS 16
+#define SEGMENT_BATCH     256
+
+/* Milliseconds the dictionaries must stay unchanged before the repl reloads
+ * them; also the polling period when change notifications are unavailable */
+#define REPL_RELOAD_PERIOD 1000
+
+/* Size and number of the blocks the repl keeps rendered results in and the
+ * most results it keeps; one result may use at most a quarter of the blocks */
+#define RESULT_CACHE_BLOCK_SIZE 4096
+#define RESULT_CACHE_BLOCKS     1024
+#define RESULT_CACHE_SLOTS      512
+#define RESULT_CACHE_INDEX_EXP  10
+#define RESULT_CACHE_END        ((u32)-1)
+
+/* NOTE: while a table is being built lists are ordered by descending bank;
+ * within a bank later entries come first. they are stably sorted by
+ * descending score (rank_defs) when they are serialized into an image, so an
+ * image is always in score order, or else when they are first looked up */
 typedef struct DictDef {
 	s8 text;
 	struct DictDef *next;
+	u32 bank;  /* index into the banks of the dict the definition came from */
+	i32 score; /* score field of the term bank entry */
+	u64 tags;  /* bits of the entry's tags in the tag table of its dict */
 } DictDef;
 
+/* NOTE: term is the normalized key; headword is the spelling of the first
+ * term bank entry interned under it (see ent_headword) */
 typedef struct {
 	s8 term;
-	DictDef *def;
+	s8 headword;
+	u32 freq;        /* lowest frequency rank from any meta bank or 0 */
+	DictDef *defs[]; /* one list per dict interned into the table */
 } DictEnt;
 
 struct ht {
 	DictEnt **ents;
 	i32 len;
+	u32 exp;
+	u32 nlists;
 };
 
+/* NOTE: the dictionary image is position independent; every offset is
+ * relative to the start of the image */
+#define DICT_IMAGE_MAGIC   0x4547414D49444A4AULL /* "JJDIMAGE" */
+#define DICT_IMAGE_VERSION 10
+
+typedef struct {
+	u64 offset;
+	u64 len;
+} DictImageString;
+
+/* NOTE: defs holds ndicts + 1 indices into the DictImageStrings that follow
+ * it; the definitions of dict i are [defs[i], defs[i + 1]). the strings are
+ * followed by the u32 bank, the i32 score and the u64 tags of each
+ * definition (see image_entry_defs) */
+typedef struct {
+	DictImageString term;
+	DictImageString headword;
+	u64             freq;
+	u64             defs[];
+} DictImageEntry;
+
+typedef struct {
+	u64 magic;
+	u32 version;
+	u32 ndicts;
+	u64 size;
+	u64 source_hash;
+	u64 slots; /* offset of (1 << ht_exp) entry offsets; 0 marks an empty slot */
+	u64 banks; /* offset of ndicts + 1 indices into the DictImageBanks that follow */
+	u64 tags;  /* offset of ndicts + 1 indices into the tag names that follow */
+	u64 tag_sets; /* offset of ndicts + 1 indices into the wide TagSets that follow */
+	u64 reverse;  /* offset of (1 << reverse_exp) + 1 u32 offsets into the postings that follow */
+	u32 reverse_exp;
+	u32 ht_exp;
+	u32 ht_len;
+	DictImageString roms[];
+} DictImageHeader;
+
+typedef struct {
+	DictImageString name;
+	u64 size;
+	u64 hash;
+} DictImageBank;
+
+typedef struct {
+	DictImageString *text;
+	u32 *banks;
+	i32 *scores;
+	u64 *tags;
+} DictImageDefs;
+
+/* NOTE: bit i of a tag set is the i-th tag interned into the table of a dict.
+ * a set holding any tag past the first TAG_BITS - 1 is instead TAG_WIDE | the
+ * index of a TagSet with all of its bits in the wide sets of the table. tags
+ * past the first TAG_NAMES are dropped */
+#define TAG_BITS  64
+#define TAG_WIDE  (1ULL << (TAG_BITS - 1))
+#define TAG_NAMES 512
+#define TAG_SLOTS 1024
+#define TAG_WORDS (TAG_NAMES / TAG_BITS)
+
+typedef struct {
+	u64 words[TAG_WORDS];
+} TagSet;
+
+typedef struct {
+	s8  names[TAG_NAMES];
+	u16 slots[TAG_SLOTS]; /* 1 + index into names or 0 */
+	u32 len;
+	TagSet *sets;      /* wide sets, each stored once */
+	u32    *set_slots; /* 1 + index into sets or 0 */
+	u32     nsets;
+	u32     sets_exp;
+} TagTable;
+
+/* NOTE: manifest entry of a term bank; the hash of a bank read from an archive
+ * is the crc32 stored in the archive */
+typedef struct {
+	s8  name;
+	u64 size;
+	u64 hash;
+} DictBank;
+
 typedef struct {
 	s8 rom;
 	s8 name;
 	struct ht ht;
+	DictBank *banks;
+	u32 nbanks;
+	u32 banks_cap;
+	TagTable *tags;
+	TagSet tag_filter; /* tags named by -t once resolved */
+	b32 tag_filter_resolved;
+	b32 absent; /* has no term banks on disk; left empty in a shared image */
+	Arena tables;    /* set when the repl parsed ht into an arena of its own */
+	u64 fingerprint; /* of the term banks parsed into tables */
 } Dict;
 
+/* NOTE: text holds every term followed by a 0 and starts with a 0 so that the
+ * suffixes starting with "\0X" belong to terms starting with X and those
+ * starting with "X\0" to terms ending in X */
+typedef struct {
+	u8  *text;
+	i32 *sa;
+	i32 *starts;  /* offset of each term in text */
+	i32 *sorted;  /* term ids in lexicographic order */
+	u8  *marks;
+	i32  len;
+	i32  nterms;
+} TermIndex;
+
+/* NOTE: keys are hashed into buckets and the ids of the terms holding any key
+ * of bucket i are stored in postings[offsets[i]..offsets[i + 1]) as varint
+ * encoded deltas of id + 1. keys sharing a bucket only add candidates that
+ * fail the final check of the definition text */
+typedef struct {
+	u32 last;    /* id + 1 of the last term added while building */
+	u32 offset;
+} ReverseBucket;
+
+typedef struct {
+	u32 *offsets;
+	u8  *postings;
+	u32  exp;
+} ReverseIndex;
+
+/* NOTE: one entry of a kanji bank; the strings are the raw bank text */
+typedef struct {
+	s8  kanji;
+	s8  onyomi;    /* space separated as in the bank */
+	s8  kunyomi;
+	s8  tags;
+	s8 *meanings;
+	u32 nmeanings;
+	u32 strokes;   /* 0 when unknown */
+	u32 dict;      /* index into default_dict_map */
+	u32 next;      /* 1 + index of the next entry of the same kanji or 0 */
+	u32 printed;   /* last query it was printed for */
+} KanjiEnt;
+
+/* NOTE: the pages cover every code point up to KANJI_CODEPOINT_MAX but only
+ * those holding a kanji are allocated; a slot holds 1 + the index of the
+ * first entry of its code point or 0 */
+typedef struct {
+	u32      *pages[(KANJI_CODEPOINT_MAX >> KANJI_PAGE_BITS) + 1];
+	KanjiEnt *ents;
+	u32       len;
+	u32       cap;
+	b32       built;
+} KanjiIndex;
+
+typedef struct {
+	i32 start; /* byte offsets in the sentence */
+	i32 end;
+	b32 known; /* unset for the edge covering one character no term starts with */
+} SegmentEdge;
+
+/* NOTE: filter has a bit set for the hash of every prefix of a term and
+ * another for every whole term so that only candidates which are likely
+ * terms are looked up. the per position arrays only grow when a longer
+ * sentence than any before it is segmented. the sentence is segmented in
+ * its normalized form (text) and offsets maps that back to the input */
+typedef struct {
+	u64 *filter;
+	u32  filter_exp;
+	i64 *cost;  /* lowest cost of a segmentation of the first i bytes */
+	i32 *back;  /* start of its last segment */
+	u8  *known;
+	u8  *text;
+	i32 *offsets;
+	s8  *segments; /* spans of the input */
+	s8  *terms;    /* the same spans of text */
+	i32  cap;
+	SegmentEdge edges[SEGMENT_BATCH + SEGMENT_MAX_CHARS + 1];
+} Segmenter;
+
+typedef struct {
+	u64 hash;       /* of the query; 0 for a free slot */
+	u32 first;      /* first block of the query followed by its output */
+	u32 key_len;
+	u32 len;
+	b32 referenced; /* set by a hit and cleared when the clock hand passes */
+} ResultCacheSlot;
+
+/* NOTE: results are chains of fixed size blocks (next) so that the cache
+ * never fragments. slots are replaced in CLOCK order: the hand skips a
+ * result that was hit since it last passed and drops any other. index maps
+ * a hash to its slot + 1 by linear probing */
+typedef struct {
+	u8  *blocks;
+	u32 *next;
+	u16 *index;
+	ResultCacheSlot *slots;
+	u32  free;  /* first free block */
+	u32  nfree;
+	u32  hand;
+	u32  tail;  /* last block of the result being stored and its fill */
+	u32  fill;
+} ResultCache;
+
+/* NOTE: while the dictionaries are rebuilt by a child process the repl keeps
+ * serving lookups from the tables it has; the new image replaces them between
+ * two queries */
+typedef struct {
+	iptr watch;         /* change notifications or -1 to poll */
+	iptr builder;       /* pid of the child building a new image or 0 */
+	u64  key;
+	u64  loaded_hash;   /* source hash of the tables being served */
+	u64  building_hash;
+	u64  polled_hash;
+	b32  changed;
+} ReplReload;
+
 #include "config.h"
 
 static void __attribute__((noreturn)) os_exit(i32);
 
 static b32 os_write(iptr, s8);
-static b32 os_read_stdin(u8 *, size);
+static b32 os_writev(iptr, IOVec *, u32);
+static size os_read_stdin(u8 *, size);
 
-static iptr os_begin_path_stream(Stream *, Arena *, u32);
-static s8   os_get_valid_file(iptr, s8, Arena *, u32);
+static iptr os_begin_path_stream(Stream *, s8, Arena *, u32);
+static s8   os_get_valid_file(iptr, Arena *, u32, s8 *);
 static void os_end_path_stream(iptr);
 
+static Arena os_new_arena(size);
+static void  os_unmap(void *, size);
+static void  os_zero_pages(void *, size);
+
+static iptr os_open_for_write(char *);
+static void os_close(iptr);
+
+static s8   os_map_file(char *);
+static s8   os_map_private_file(char *);
+static b32  os_publish_file(char *, s8);
+static u64  os_dir_fingerprint(char *, s8);
+
+static u64 os_timer(void);
+static u64 os_timer_frequency(void);
+
+static u32 os_cpu_features(void);
+
+/* NOTE: os_wait_for_input returns a mask of these; 0 when the timeout expired */
+enum os_input_flags {
+	OS_INPUT_READY   = 1 << 0,
+	OS_INPUT_CHANGED = 1 << 1,
+};
+
+static iptr os_watch_new(void);
+static void os_watch_path(iptr, char *);
+static u32  os_wait_for_input(iptr, i32);
+static iptr os_fork(void);
+static b32  os_child_done(iptr, b32 *);
+
 static Stream error_stream;
 static Stream stdout_stream;
+static Stats  stats;
+static Trace  trace;
+
+/* map term banks instead of reading them into the arena (--mmap) */
+static b32 use_mmap_reads;
+
+/* NOTE: when built (-m or when publishing an image) every dict is interned into
+ * this one table and entries hold one list per dict in configuration order.
+ * without an image the repl instead links the lists of the tables of each
+ * dict into it (see make_merged_view) */
+static struct ht merged_index;
+
+/* NOTE: set while the repl parses dicts again; once a query is waiting the
+ * banks left are skipped and parse_yielded is set (see parse_should_yield) */
+static b32 parse_yield;
+static b32 parse_yielded;
+
+/* when set every lookup is served from a mapped image instead of a table */
+static DictImageHeader *dict_image;
+
+/* NOTE: build.sh embed links an image written by --write-image into the
+ * binary. it is served in place so the term banks are never opened and its
+ * pages are shared through the page cache of the executable */
+#ifdef EMBED_IMAGE
+asm(".section .rodata\n"
+    ".balign 4096\n"
+    "jdict_embedded_image:\n"
+    ".incbin \"" EMBED_IMAGE "\"\n"
+    "jdict_embedded_image_end:\n"
+    ".previous\n");
+extern u8 embedded_image[]     asm("jdict_embedded_image");
+extern u8 embedded_image_end[] asm("jdict_embedded_image_end");
+#define EMBEDDED_IMAGE (s8){.len = embedded_image_end - embedded_image, .s = embedded_image}
+#else
+#define EMBEDDED_IMAGE (s8){0}
+#endif
+
+/* NOTE: set while a stale image is being replaced. banks whose size and hash
+ * match its manifest are not parsed; their definitions are copied from it
+ * once the changed banks have been interned */
+static struct {
+	DictImageHeader *image;
+	u32             *remap; /* new bank of each bank of image or BANK_NONE */
+} dict_image_base;
+#define BANK_NONE ((u32)-1)
+
+/* NOTE: built on the first wildcard query from the tables serving lookups */
+static TermIndex term_index;
+
+/* NOTE: built on the first reverse query (-r) over the terms of term_index */
+static ReverseIndex reverse_index;
+
+/* NOTE: built on the first kanji query (-k) from the kanji banks */
+static KanjiIndex kanji_index;
+
+/* NOTE: built on the first segmented sentence (-a) from the tables serving lookups */
+static Segmenter segmenter;
+
+/* NOTE: built on the first repl query; every output option is fixed for the
+ * session so the normalized query alone is the key */
+static ResultCache result_cache;
+
+/* print the term along with its definitions (set for wildcard and reverse queries) */
+static b32 print_terms;
+
+/* print one JSON object per term and dictionary instead of text (-j) */
+static b32 print_json;
+
+/* NOTE: when set at most this many definitions are printed per term and
+ * dictionary and wildcard and reverse queries only keep this many of their
+ * most frequent terms (-n) */
+static u32 print_limit;
+
+/* NOTE: comma separated tags of which a definition must have at least one to
+ * be printed (-t); resolved to a tag set per dict on first use */
+static s8 tag_filter;
+
+static s8 repl_stats_command = s8(":stats");
+
+static void
+stream_close_run(Stream *s)
+{
+	if (s->widx > s->mark) {
+		s->iov[s->iov_len++] = (IOVec){.base = s->data + s->mark, .len = s->widx - s->mark};
+		s->mark = s->widx;
+	}
+}
 
 static void
 stream_flush(Stream *s)
 {
+	stats.stream_flushes++;
 	if (s->fd <= 0) {
 		s->errors = 1;
+	} else if (s->iov_len) {
+		stream_close_run(s);
+		s->errors = !os_writev(s->fd, s->iov, s->iov_len);
+		if (!s->errors) s->widx = s->mark = s->iov_len = s->gathered = 0;
 	} else if (s->widx) {
 		s->errors = !os_write(s->fd, (s8){.len = s->widx, .s = s->data});
 		if (!s->errors) s->widx = 0;
@@ -121,19 +586,41 @@ stream_append_s8(Stream *s, s8 str)
 		stream_flush(s);
 	s->errors |= (s->cap - s->widx) < str.len;
 	if (!s->errors) {
-		for (size i = 0; i < str.len; i++)
-			s->data[s->widx++] = str.s[i];
+		simd.copy(s->data + s->widx, str.s, str.len);
+		s->widx += str.len;
+	}
+}
+
+/* NOTE: str is not copied so it must stay valid until the next flush; short
+ * strings are cheaper to copy than to give their own iovec */
+static void
+stream_append_ref(Stream *s, s8 str)
+{
+	if (!s->iov || str.len < STREAM_REF_MIN) {
+		stream_append_s8(s, str);
+		return;
+	}
+	/* NOTE: keep one slot free for the run buffered before the flush */
+	if (s->iov_len + 3 > s->iov_cap || s->gathered > STREAM_GATHER_MAX)
+		stream_flush(s);
+	if (!s->errors) {
+		stream_close_run(s);
+		s->iov[s->iov_len++] = (IOVec){.base = str.s, .len = str.len};
+		s->gathered         += str.len;
+		stats.bytes_gathered += str.len;
 	}
 }
 
 static void
 stream_ensure_newline(Stream *s)
 {
-	if (s->widx && s->data[s->widx - 1] != '\n')
+	u8 *last = 0;
+	if (s->widx > s->mark) last = s->data + s->widx - 1;
+	else if (s->iov_len)   last = (u8 *)s->iov[s->iov_len - 1].base + s->iov[s->iov_len - 1].len - 1;
+	if (last && *last != '\n')
 		stream_append_byte(s, '\n');
 }
 
-#ifdef _DEBUG_ARENA
 static void
 stream_append_u64(Stream *s, u64 n)
 {
@@ -143,7 +630,6 @@ stream_append_u64(Stream *s, u64 n)
 	do { *--beg = '0' + (n % 10); } while (n /= 10);
 	stream_append_s8(s, (s8){.len = end - beg, .s = beg});
 }
-#endif
 
 static s8
 cstr_to_s8(char *cstr)
@@ -165,16 +651,91 @@ static void *
 mem_clear(void *p_, u8 c, size len)
 {
 	u8 *p = p_;
-	while (len) p[--len] = c;
-	return p;
+	/* NOTE: bytes up to the first word boundary, then whole words, then the tail */
+	while (len && ((usize)p & (sizeof(u64) - 1))) { *p++ = c; len--; }
+	u64 *w = (u64 *)p, word = 0x0101010101010101ULL * c;
+	for (; len >= (size)sizeof(u64); len -= sizeof(u64)) *w++ = word;
+	for (p = (u8 *)w; len; len--) *p++ = c;
+	return p_;
 }
 
+/* smallest cleared allocation zeroed with os_zero_pages instead of mem_clear */
+#define ARENA_ZERO_PAGES_MIN (size)(1 * MEGABYTE)
+
 enum arena_flags {
 	ARENA_NONE      = 0 << 0,
 	ARENA_NO_CLEAR  = 1 << 0,
 	ARENA_ALLOC_END = 1 << 1,
 };
 
+static void __attribute__((noreturn))
+arena_out_of_memory(size requested)
+{
+	stream_append_s8(&error_stream, s8("out of memory: failed to allocate "));
+	stream_append_u64(&error_stream, requested);
+	stream_append_s8(&error_stream, s8(" bytes with "));
+	stream_append_u64(&error_stream, stats.arena_capacity);
+	stream_append_s8(&error_stream, s8(" bytes in use"));
+	if (arena_budget) {
+		stream_append_s8(&error_stream, s8(" (budget "));
+		stream_append_u64(&error_stream, arena_budget);
+		stream_append_s8(&error_stream, s8(" bytes)"));
+	}
+	die(&error_stream);
+}
+
+static Arena
+arena_new(ArenaBlock *prev, size min_size)
+{
+	size block_size = ARENA_BLOCK_SIZE;
+	if (block_size < min_size + (size)sizeof(ArenaBlock))
+		block_size = min_size + sizeof(ArenaBlock);
+	block_size += -block_size & (HUGEPAGE_SIZE - 1);
+
+	if (arena_budget && stats.arena_capacity + block_size > arena_budget) {
+		block_size = (arena_budget - stats.arena_capacity) & ~(HUGEPAGE_SIZE - 1);
+		if (block_size < min_size + (size)sizeof(ArenaBlock))
+			arena_out_of_memory(min_size);
+	}
+
+	Arena result = os_new_arena(block_size);
+	if (!result.beg)
+		arena_out_of_memory(min_size);
+
+	if (stats.arena_capacity > stats.arena_peak)
+		stats.arena_peak = stats.arena_capacity;
+
+	result.block       = (ArenaBlock *)result.beg;
+	result.block->prev = prev;
+	result.block->size = result.end - result.beg;
+	result.beg        += sizeof(ArenaBlock);
+	return result;
+}
+
+/* NOTE: resets a to mark, a copy of it taken earlier; blocks chained to a
+ * since then are returned to the OS but memory in mark's block is kept */
+static void
+arena_rewind(Arena *a, Arena mark)
+{
+	while (a->block != mark.block) {
+		ArenaBlock *block = a->block;
+		a->block = block->prev;
+		stats.arena_capacity -= block->size;
+		os_unmap(block, block->size);
+	}
+	*a = mark;
+}
+
+/* returns everything allocated from a since it was copied from base to the OS */
+static void
+arena_release(Arena base, Arena *a)
+{
+	u8 *used_end = a->block == base.block ? a->beg : base.end;
+	arena_rewind(a, base);
+	if (used_end > base.beg)
+		os_zero_pages(base.beg, used_end - base.beg);
+}
+
 #define alloc(a, t, n, flags)  (t *)alloc_(a, sizeof(t), _Alignof(t), n, flags)
 static void *
 alloc_(Arena *a, size len, size align, size count, u32 flags)
@@ -184,8 +745,14 @@ alloc_(Arena *a, size len, size align, size count, u32 flags)
 	else                         padding = -(usize)a->beg & (align - 1);
 
 	size available = a->end - a->beg - padding;
-	if (available <= 0 || available / len <= count)
-		ASSERT(0);
+	if (available < 0 || available / len < count) {
+		size limit = (usize)-1 >> 1;
+		if (count > (limit - align) / len)
+			arena_out_of_memory(limit);
+		*a = arena_new(a->block, len * count + align);
+		if (flags & ARENA_ALLOC_END) padding =  (usize)a->end & (align - 1);
+		else                         padding = -(usize)a->beg & (align - 1);
+	}
 
 	void *result;
 	if (flags & ARENA_ALLOC_END) {
@@ -196,13 +763,102 @@ alloc_(Arena *a, size len, size align, size count, u32 flags)
 		a->beg += padding + count * len;
 	}
 
-#ifdef _DEBUG_ARENA
-	if (a->end - a->beg < a->min_capacity_remaining)
-		a->min_capacity_remaining = a->end - a->beg;
-#endif
+	/* NOTE: large regions are handed back to the OS instead of being written;
+	 * the pages read back as zero and are only faulted in when touched */
+	if (flags & ARENA_NO_CLEAR)                   return result;
+	else if (count * len >= ARENA_ZERO_PAGES_MIN) os_zero_pages(result, count * len);
+	else                                          mem_clear(result, 0, count * len);
+	return result;
+}
+
+static void
+trace_init(Arena *a, u32 cap)
+{
+	trace.cap        = cap;
+	trace.events     = alloc(a, TraceEvent, cap, 0);
+	trace.timer_base = os_timer();
+}
+
+static TraceZone
+trace_begin(s8 name, s8 detail)
+{
+	TraceZone result = {.name = name, .detail = detail};
+	if (trace.events) result.begin = os_timer();
+	return result;
+}
+
+static void
+trace_end(TraceZone z)
+{
+	if (!trace.events)
+		return;
+	u64 end = os_timer();
+	u32 idx = __atomic_fetch_add(&trace.count, 1, __ATOMIC_RELAXED) & (trace.cap - 1);
+	TraceEvent *e = trace.events + idx;
+	e->name  = z.name;
+	e->begin = z.begin;
+	e->end   = end;
+	e->tid   = z.tid;
+	e->detail_len = z.detail.len < TRACE_DETAIL_LEN ? z.detail.len : TRACE_DETAIL_LEN;
+	for (u32 i = 0; i < e->detail_len; i++)
+		e->detail[i] = z.detail.s[i];
+}
+
+/* appends a tick count as microseconds with nanosecond precision */
+static void
+stream_append_trace_us(Stream *s, u64 ticks, u64 freq)
+{
+	u64 ns = (ticks / freq) * 1000000000ULL + (ticks % freq) * 1000000000ULL / freq;
+	u64 frac = ns % 1000;
+	stream_append_u64(s, ns / 1000);
+	stream_append_byte(s, '.');
+	stream_append_byte(s, '0' + frac / 100);
+	stream_append_byte(s, '0' + frac / 10 % 10);
+	stream_append_byte(s, '0' + frac % 10);
+}
+
+/* writes the recorded zones in chrome trace event format */
+static void
+trace_dump(Arena a, char *path)
+{
+	Stream out = {.cap = 1 * MEGABYTE};
+	out.data   = alloc(&a, u8, out.cap, ARENA_NO_CLEAR);
+	out.fd     = os_open_for_write(path);
+	if (out.fd < 0) {
+		stream_append_s8(&error_stream, s8("failed to open trace file: "));
+		stream_append_s8(&error_stream, cstr_to_s8(path));
+		stream_append_byte(&error_stream, '\n');
+		return;
+	}
 
-	if (flags & ARENA_NO_CLEAR) return result;
-	else                        return mem_clear(result, 0, count * len);
+	u64 freq  = os_timer_frequency();
+	u32 first = trace.count > trace.cap ? trace.count - trace.cap : 0;
+	stream_append_s8(&out, s8("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"));
+	for (u32 i = first; i < trace.count; i++) {
+		TraceEvent *e = trace.events + (i & (trace.cap - 1));
+		if (i != first) stream_append_s8(&out, s8(",\n"));
+		stream_append_s8(&out, s8("{\"name\":\""));
+		stream_append_s8(&out, e->name);
+		stream_append_s8(&out, s8("\",\"cat\":\"jdict\",\"ph\":\"X\",\"pid\":1,\"tid\":"));
+		stream_append_u64(&out, e->tid);
+		stream_append_s8(&out, s8(",\"ts\":"));
+		stream_append_trace_us(&out, e->begin - trace.timer_base, freq);
+		stream_append_s8(&out, s8(",\"dur\":"));
+		stream_append_trace_us(&out, e->end - e->begin, freq);
+		if (e->detail_len) {
+			stream_append_s8(&out, s8(",\"args\":{\"detail\":\""));
+			for (u32 j = 0; j < e->detail_len; j++) {
+				u8 c = e->detail[j];
+				if (c >= 0x20 && c != '"' && c != '\\')
+					stream_append_byte(&out, c);
+			}
+			stream_append_s8(&out, s8("\"}"));
+		}
+		stream_append_byte(&out, '}');
+	}
+	stream_append_s8(&out, s8("\n]}\n"));
+	stream_flush(&out);
+	os_close(out.fd);
 }
 
 static void
@@ -210,7 +866,7 @@ usage(s8 argv0)
 {
 	stream_append_s8(&error_stream, s8("usage: "));
 	stream_append_s8(&error_stream, argv0);
-	stream_append_s8(&error_stream, s8(" [-d path] [-F FS] [-i] term ...\n"));
+	stream_append_s8(&error_stream, s8(" [-a] [-b] [-d path] [-F FS] [-i] [-j] [-k] [-m] [-n count] [-r] [-t tags] [--memory size] [--mmap] [--stats] [--trace file] [--write-image file] term ...\n"));
 	die(&error_stream);
 }
 
@@ -218,20 +874,19 @@ static s8
 s8_dup(Arena *a, s8 old)
 {
 	s8 result = {.len = old.len, .s = alloc(a, u8, old.len, ARENA_NO_CLEAR)};
-	for (size i = 0; i < old.len; i++)
-		result.s[i] = old.s[i];
+	simd.copy(result.s, old.s, old.len);
 	return result;
 }
 
 static b32
 s8_equal(s8 a, s8 b)
 {
-	i32 result = 0;
+	u32 result = 0;
 	if (a.len != b.len)
 		return 0;
 	/* NOTE: we assume short strings in this program */
 	for (size i = 0; i < a.len; i++)
-		result += b.s[i] - a.s[i];
+		result |= b.s[i] ^ a.s[i];
 	return result == 0;
 }
 
@@ -259,6 +914,96 @@ s8trim(s8 str)
 	return str;
 }
 
+/* parses a byte count with an optional K, M or G suffix; returns -1 if invalid */
+static size
+parse_memory_size(s8 str)
+{
+	size limit = (usize)-1 >> 1;
+	size result = 0, i = 0;
+	for (; i < str.len && ISDIGIT(str.s[i]); i++) {
+		if (result > (limit - 9) / 10)
+			return -1;
+		result = result * 10 + str.s[i] - '0';
+	}
+
+	u32 shift = 0;
+	if (i + 1 == str.len) {
+		switch (str.s[i] | 0x20) {
+		case 'k': shift = 10; break;
+		case 'm': shift = 20; break;
+		case 'g': shift = 30; break;
+		default:  return -1;
+		}
+	} else if (i != str.len) {
+		return -1;
+	}
+
+	if (i == 0 || result > limit >> shift)
+		return -1;
+	return result << shift;
+}
+
+/* NOTE: parses a leading integer and stops at the first other byte (such as
+ * a fraction); saturates instead of overflowing */
+static i32
+parse_i32(s8 str)
+{
+	b32 negative = str.len && str.s[0] == '-';
+	i64 result   = 0;
+	for (size i = negative; i < str.len && ISDIGIT(str.s[i]); i++)
+		if (result <= 0x7FFFFFFF) result = result * 10 + str.s[i] - '0';
+	result = MIN(result, 0x7FFFFFFF);
+	return negative ? -result : result;
+}
+
+/* parses a positive count made up only of digits; returns -1 if invalid */
+static i32
+parse_count(s8 str)
+{
+	for (size i = 0; i < str.len; i++)
+		if (!ISDIGIT(str.s[i]))
+			return -1;
+	i32 result = parse_i32(str);
+	return result > 0 ? result : -1;
+}
+
+/* NOTE: the text following the first occurrence of key in a JSON object or
+ * an empty string with s unset; objects here are small enough to search */
+static s8
+json_after_key(s8 obj, s8 key)
+{
+	for (size at = 0; at + key.len <= obj.len; at++)
+		if (s8_equal((s8){.len = key.len, .s = obj.s + at}, key))
+			return s8_cut_head(obj, at + key.len);
+	return (s8){0};
+}
+
+/* NOTE: parses the first run of digits in str (which may be quoted) */
+static u32
+parse_first_u32(s8 str)
+{
+	while (str.len && !ISDIGIT(str.s[0]))
+		str = s8_cut_head(str, 1);
+	return parse_i32(str);
+}
+
+/* NOTE: the frequency of a meta bank entry is a number, a string or an object
+ * holding either under "value" or "frequency" (along with a reading which is
+ * ignored). it is a rank so lower values are more frequent; 0 is unknown */
+static u32
+parse_frequency(s8 value)
+{
+	s8 keys[] = {s8("\"value\""), s8("\"frequency\"")};
+	for (u32 i = 0; i < ARRAY_COUNT(keys); i++) {
+		s8 after = json_after_key(value, keys[i]);
+		if (after.s) {
+			value = after;
+			break;
+		}
+	}
+	return parse_first_u32(value);
+}
+
 /* replace escaped control chars with their actual char */
 static s8
 unescape(s8 str)
@@ -278,6 +1023,131 @@ unescape(s8 str)
 	return str;
 }
 
+/* like s8trim but also trims escaped whitespace (\\n and \\t) */
+static s8
+s8trim_escaped(s8 str)
+{
+	for (;;) {
+		if (str.len && ISSPACE(str.s[str.len - 1])) {
+			str.len--;
+		} else if (str.len >= 2 && str.s[str.len - 2] == '\\' &&
+		           (str.s[str.len - 1] == 'n' || str.s[str.len - 1] == 't')) {
+			str.len -= 2;
+		} else {
+			break;
+		}
+	}
+	for (;;) {
+		if (str.len && ISSPACE(str.s[0])) {
+			str = s8_cut_head(str, 1);
+		} else if (str.len >= 2 && str.s[0] == '\\' && (str.s[1] == 'n' || str.s[1] == 't')) {
+			str = s8_cut_head(str, 2);
+		} else {
+			break;
+		}
+	}
+	return str;
+}
+
+/* append the raw body of a JSON string replacing the escapes of control
+ * chars, quotes, slashes and backslashes with the char itself (\\u escapes
+ * are kept); unlike unescape() str is not modified so it may point at
+ * read-only memory. the runs between escapes are appended by reference */
+static void
+stream_append_unescaped(Stream *s, s8 str)
+{
+	size run = 0;
+	for (size i = 0; i + 1 < str.len; i++) {
+		if (str.s[i] != '\\')
+			continue;
+		u8 c;
+		switch (str.s[i + 1]) {
+		case 'n':  c = '\n'; break;
+		case 't':  c = '\t'; break;
+		case '"':  c = '"';  break;
+		case '/':  c = '/';  break;
+		case '\\': c = '\\'; break;
+		default:   continue;
+		}
+		stream_append_ref(s, (s8){.len = i - run, .s = str.s + run});
+		stream_append_byte(s, c);
+		run = ++i + 1;
+	}
+	stream_append_ref(s, (s8){.len = str.len - run, .s = str.s + run});
+}
+
+/* NOTE: a definition is the raw body of a JSON string or, for structured
+ * content, the raw text of a whole object or array. the body of a string
+ * never holds an unescaped quote while an object or array holding a string
+ * always does; any other one is made up of bytes that escape the same way */
+static b32
+json_is_string_body(s8 str)
+{
+	if (!str.len || (str.s[0] != '{' && str.s[0] != '['))
+		return 1;
+	for (size i = 0; (i += simd.scan2(str.s + i, str.len - i, '"', '"')) < str.len; i++) {
+		size escapes = 0;
+		while (escapes < i && str.s[i - escapes - 1] == '\\')
+			escapes++;
+		if (escapes % 2 == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* NOTE: writes str as the body of a JSON string. when escaped is set str is
+ * the raw body of a string from a term bank whose escapes are already valid
+ * JSON; they are passed through and only the bytes that would break the
+ * output are escaped */
+static void
+stream_append_json(Stream *s, s8 str, b32 escaped)
+{
+	static u8 hex[] = "0123456789abcdef";
+	/* NOTE: valid escapes are kept in the run so that a definition is usually
+	 * written with a single reference */
+	size run = 0;
+	for (size i = 0;;) {
+		i += simd.json_span(str.s + i, str.len - i);
+		if (i == str.len)
+			break;
+
+		u8 c = str.s[i];
+		size len = 0;
+		if (escaped && c == '\\' && i + 1 < str.len) {
+			switch (str.s[i + 1]) {
+			case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+				len = 2;
+				break;
+			case 'u':
+				len = 6;
+				for (size j = i + 2; len && j < i + 6; j++)
+					if (j >= str.len || !ISHEX(str.s[j])) len = 0;
+				break;
+			}
+		}
+		if (len) {
+			i += len;
+			continue;
+		}
+
+		stream_append_ref(s, (s8){.len = i - run, .s = str.s + run});
+		stream_append_byte(s, '\\');
+		switch (c) {
+		case '"':  stream_append_byte(s, '"');  break;
+		case '\\': stream_append_byte(s, '\\'); break;
+		case '\n': stream_append_byte(s, 'n');  break;
+		case '\t': stream_append_byte(s, 't');  break;
+		default:
+			stream_append_s8(s, s8("u00"));
+			stream_append_byte(s, hex[c >> 4]);
+			stream_append_byte(s, hex[c & 15]);
+			break;
+		}
+		run = ++i;
+	}
+	stream_append_ref(s, (s8){.len = str.len - run, .s = str.s + run});
+}
+
 /* FNV-1a hash */
 static u64
 hash(s8 v)
@@ -290,6 +1160,23 @@ hash(s8 v)
 	return h;
 }
 
+/* NOTE: only has to tell versions of a term bank apart; mixes a word at a time */
+static u64
+bank_hash(s8 data)
+{
+	u64 h = 0x3243f6a8885a308d ^ data.len;
+	size i = 0;
+	for (; i + 8 <= data.len; i += 8) {
+		u64 word;
+		__builtin_memcpy(&word, data.s + i, sizeof(word));
+		h  = (h ^ word) * 1111111111111111111;
+		h ^= h >> 29;
+	}
+	for (; i < data.len; i++)
+		h = (h ^ data.s[i]) * 1111111111111111111;
+	return h;
+}
+
 static i32
 ht_lookup(u64 hash, int exp, i32 idx)
 {
@@ -298,45 +1185,148 @@ ht_lookup(u64 hash, int exp, i32 idx)
 	return (idx + step) & mask;
 }
 
+static void
+stats_count_probes(u64 *histogram, u32 probes)
+{
+	if (probes > STATS_PROBE_BUCKETS) probes = STATS_PROBE_BUCKETS;
+	histogram[probes - 1]++;
+}
+
+/* NOTE: the old slots are abandoned in the arena */
+static void
+ht_grow(Arena *a, struct ht *t)
+{
+	struct ht old = *t;
+	t->exp++;
+	t->ents = alloc(a, DictEnt *, (size)1 << t->exp, 0);
+	for (size i = 0; i < (size)1 << old.exp; i++) {
+		DictEnt *ent = old.ents[i];
+		if (!ent)
+			continue;
+		u64 h = hash(ent->term);
+		i32 j = h;
+		do j = ht_lookup(h, t->exp, j); while (t->ents[j]);
+		t->ents[j] = ent;
+	}
+	stats.table_grows++;
+}
+
 static DictEnt **
-intern(struct ht *t, s8 key)
+intern(Arena *a, struct ht *t, s8 key)
 {
+	if ((u32)t->len + 1 >= (u32)1 << (t->exp - 1))
+		ht_grow(a, t);
+
 	u64 h = hash(key);
 	i32 i = h;
-	for (;;) {
-		i = ht_lookup(h, HT_EXP, i);
+	for (u32 probes = 1;; probes++) {
+		i = ht_lookup(h, t->exp, i);
 		if (!t->ents[i]) {
 			/* empty slot */
-			#ifdef _DEBUG
-			if ((u32)t->len + 1 == (u32)1<<(HT_EXP - 1)) {
-				stream_append_s8(&error_stream,
-				                 s8("intern: ht exceeded 0.5 fill factor\n"));
-			}
-			#endif
 			t->len++;
+			stats.entries_interned++;
+			stats_count_probes(stats.intern_probes, probes);
 			return t->ents + i;
 		} else if (s8_equal(t->ents[i]->term, key)) {
 			/* found; return the stored instance */
+			stats_count_probes(stats.intern_probes, probes);
 			return t->ents + i;
 		}
 		/* NOTE: else relookup and try again */
+		stats.intern_collisions++;
 	}
 }
 
+/* NOTE: terms are folded so that spellings differing only in script or width
+ * share an entry; queries are folded the same way before lookup */
+static s8
+normalize_term(Arena *a, s8 term)
+{
+	s8 result  = {.s = alloc(a, u8, NORMALIZE_MAX_LEN(term.len), ARENA_NO_CLEAR)};
+	result.len = normalize_utf8(result.s, term.s, term.len, 0);
+	return result;
+}
+
+/* NOTE: lists are kept in descending bank order; def goes in front of the
+ * definitions already in list from its own bank */
 static void
-parse_term_bank(Arena *a, struct ht *ht, s8 data)
+dict_def_insert(DictDef **list, DictDef *def)
 {
-	/* allocate tokens */
-	size ntoks = (1 << HT_EXP) * YOMI_TOKS_PER_ENT + 1;
-	YomiTok *toks = alloc(a, YomiTok, ntoks, ARENA_ALLOC_END|ARENA_NO_CLEAR);
+	while (*list && (*list)->bank > def->bank)
+		list = &(*list)->next;
+	def->next = *list;
+	*list     = def;
+}
 
-	YomiScanner s = {0};
+/* NOTE: stable insertion sort by descending score; most lists are short and
+ * appending to the tail keeps the common already sorted case linear */
+static DictDef *
+rank_defs(DictDef *list)
+{
+	DictDef *result = 0, *last = 0;
+	while (list) {
+		DictDef *def = list;
+		list = list->next;
+		if (!last || last->score >= def->score) {
+			def->next = 0;
+			if (last) last->next = def;
+			else      result     = def;
+			last = def;
+		} else {
+			DictDef **at = &result;
+			while ((*at)->score >= def->score)
+				at = &(*at)->next;
+			def->next = *at;
+			*at       = def;
+		}
+	}
+	return result;
+}
+
+static DictEnt *
+intern_ent(Arena *a, struct ht *ht, s8 key)
+{
+	DictEnt **n = intern(a, ht, key);
+	if (!*n) {
+		*n         = alloc_(a, sizeof(DictEnt) + ht->nlists * sizeof(DictDef *),
+		                    _Alignof(DictEnt), 1, 0);
+		(*n)->term = s8_dup(a, key);
+	} else if (!s8_equal((*n)->term, key)) {
+		stream_append_s8(&error_stream, s8("hash collision: "));
+		stream_append_s8(&error_stream, key);
+		stream_append_byte(&error_stream, '\t');
+		stream_append_s8(&error_stream, (*n)->term);
+		stream_append_byte(&error_stream, '\n');
+	}
+	return *n;
+}
+
+/* NOTE: entries only known from a meta bank have no headword of their own */
+static s8
+ent_headword(DictEnt *e)
+{
+	return e->headword.len ? e->headword : e->term;
+}
+
+/* NOTE: lexes a bank into tokens allocated from scratch; returns the number
+ * of tokens or 0 if the bank is invalid */
+static i32
+lex_bank(Arena *scratch, s8 data, YomiTok **result)
+{
+	size ntoks    = data.len / YOMI_BYTES_PER_TOK + 64;
+	YomiTok *toks = alloc(scratch, YomiTok, ntoks, ARENA_NO_CLEAR);
+
+	YomiScanner s = {0};
 	yomi_scanner_init(&s, (char *)data.s, data.len);
+	TraceZone scan_zone = trace_begin(s8("yomi_scan"), s8(""));
 	i32 r;
 	while ((r = yomi_scan(&s, toks, ntoks)) < 0) {
 		switch (r) {
 		case YOMI_ERROR_NOMEM:
-			goto cleanup;
+			ntoks *= 2;
+			toks   = alloc(scratch, YomiTok, ntoks, ARENA_NO_CLEAR);
+			yomi_scanner_init(&s, (char *)data.s, data.len);
+			break;
 		case YOMI_ERROR_INVAL:
 		case YOMI_ERROR_MALFO:
 			stream_append_s8(&error_stream, s8("yomi_parse: "));
@@ -344,196 +1334,3142 @@ parse_term_bank(Arena *a, struct ht *ht, s8 data)
 				stream_append_s8(&error_stream, s8("YOMI_ERROR_INVAL\n"));
 			else
 				stream_append_s8(&error_stream, s8("YOMI_ERROR_MALFO\n"));
-			goto cleanup;
+			trace_end(scan_zone);
+			return 0;
+		}
+	}
+
+	trace_end(scan_zone);
+
+	stats.tokens_scanned += r;
+	*result = toks;
+	return r;
+}
+
+/* returns the bit of tag in tt; tags are added unless tt is full in which
+ * case TAG_NAMES is returned */
+static u32
+tag_intern(Arena *a, TagTable *tt, s8 tag)
+{
+	u64 h = hash(tag);
+	u32 i = h;
+	for (;;) {
+		i &= TAG_SLOTS - 1;
+		u32 slot = tt->slots[i];
+		if (!slot) {
+			if (tt->len == TAG_NAMES)
+				return TAG_NAMES;
+			tt->names[tt->len] = s8_dup(a, tag);
+			tt->slots[i]       = ++tt->len;
+			slot               = tt->len;
+		}
+		if (s8_equal(tt->names[slot - 1], tag))
+			return slot - 1;
+		i += (h >> 32) | 1;
+	}
+}
+
+static s8
+tag_set_bytes(TagSet *set)
+{
+	return (s8){.len = sizeof(*set), .s = (u8 *)set};
+}
+
+static void
+tag_set_add(TagSet *set, u32 bit)
+{
+	if (bit < TAG_NAMES)
+		set->words[bit / TAG_BITS] |= 1ULL << (bit % TAG_BITS);
+}
+
+/* returns set as it is stored in a tag set of tt (see TAG_WIDE) */
+static u64
+tag_set_intern(Arena *a, TagTable *tt, TagSet *set)
+{
+	u64 wide = set->words[0] & TAG_WIDE;
+	for (u32 k = 1; k < TAG_WORDS; k++)
+		wide |= set->words[k];
+	if (!wide)
+		return set->words[0];
+
+	/* NOTE: sets has room for half as many as set_slots */
+	if (tt->nsets == (1u << tt->sets_exp) >> 1) {
+		u32 exp = tt->sets_exp ? tt->sets_exp + 1 : 6;
+		TagSet *sets = alloc(a, TagSet, (size)1 << (exp - 1), ARENA_NO_CLEAR);
+		u32 *slots   = alloc(a, u32, (size)1 << exp, 0);
+		for (u32 j = 0; j < tt->nsets; j++) {
+			sets[j] = tt->sets[j];
+			u64 h   = hash(tag_set_bytes(sets + j));
+			i32 i   = h;
+			do i = ht_lookup(h, exp, i); while (slots[i]);
+			slots[i] = j + 1;
+		}
+		tt->sets      = sets;
+		tt->set_slots = slots;
+		tt->sets_exp  = exp;
+	}
+
+	u64 h = hash(tag_set_bytes(set));
+	for (i32 i = h;;) {
+		i = ht_lookup(h, tt->sets_exp, i);
+		u32 slot = tt->set_slots[i];
+		if (!slot) {
+			tt->sets[tt->nsets] = *set;
+			tt->set_slots[i]    = ++tt->nsets;
+			slot                = tt->nsets;
+		}
+		if (s8_equal(tag_set_bytes(tt->sets + slot - 1), tag_set_bytes(set)))
+			return TAG_WIDE | (slot - 1);
+	}
+}
+
+/* NOTE: sets are the wide sets tags may refer to; filter is usually all in its
+ * first word and most tags are not wide so this is a single AND */
+static b32
+tag_set_matches(u64 tags, TagSet *filter, TagSet *sets)
+{
+	if (!(tags & TAG_WIDE))
+		return (tags & filter->words[0]) != 0;
+	TagSet *set = sets + (tags & ~TAG_WIDE);
+	for (u32 k = 0; k < TAG_WORDS; k++)
+		if (set->words[k] & filter->words[k])
+			return 1;
+	return 0;
+}
+
+/* NOTE: field is a space separated list of tags as found in a term bank */
+static u64
+dict_tag_set(Arena *a, Dict *d, s8 field)
+{
+	TagSet result = {0};
+	while (field.len) {
+		s8 tag = {.s = field.s};
+		for (; tag.len < field.len && field.s[tag.len] != ' '; tag.len++);
+		if (tag.len) {
+			if (!d->tags) d->tags = alloc(a, TagTable, 1, 0);
+			tag_set_add(&result, tag_intern(a, d->tags, tag));
+		}
+		field = s8_cut_head(field, MIN(field.len, tag.len + 1));
+	}
+	return d->tags ? tag_set_intern(a, d->tags, &result) : 0;
+}
+
+/* NOTE: tokens live in scratch which is released by the caller once the bank
+ * has been interned into ht */
+static void
+parse_term_bank(Arena *a, Arena *scratch, Dict *d, struct ht *ht, s8 data, u32 list, u32 bank)
+{
+	YomiTok *toks;
+	i32 r = lex_bank(scratch, data, &toks);
+	if (!r)
+		goto cleanup;
+
+	TraceZone entry_zone = trace_begin(s8("parse_term_bank"), s8(""));
+	for (i32 i = 0; i < r; i++) {
+		YomiTok *base_tok = toks + i;
+		if (base_tok->type != YOMI_ENTRY)
+			continue;
+
+		YomiTok *tstr = 0, *tdefs = 0, *tscore = 0;
+		for (usize j = 1; j < base_tok->len; j++) {
+			switch (base_tok[j].type) {
+			case YOMI_STR:   if (!tstr)   tstr   = base_tok + j; break;
+			case YOMI_ARRAY: if (!tdefs)  tdefs  = base_tok + j; break;
+			case YOMI_NUM:   if (!tscore) tscore = base_tok + j; break;
+			default: break;
+			}
+		}
+
+		/* NOTE: [term, "freq", value] from a meta bank; other meta entries
+		 * (pitch accents) are skipped. len counts the direct children of the
+		 * entry so the value is base_tok[3] */
+		if (!tdefs && base_tok->len >= 3 && tstr == base_tok + 1 &&
+		    base_tok[2].type == YOMI_STR) {
+			s8 mode = {.len = base_tok[2].end - base_tok[2].start, .s = data.s + base_tok[2].start};
+			if (!s8_equal(mode, s8("freq")))
+				continue;
+			s8 value = {.len = base_tok[3].end - base_tok[3].start, .s = data.s + base_tok[3].start};
+			u32 freq = parse_frequency(value);
+			if (freq) {
+				s8 mem_term = {.len = tstr->end - tstr->start, .s = data.s + tstr->start};
+				DictEnt *e  = intern_ent(a, ht, normalize_term(scratch, mem_term));
+				if (!e->freq || freq < e->freq)
+					e->freq = freq;
+			}
+			continue;
+		}
+
+		/* check if entry was valid */
+		if (!tdefs || !tstr) {
+			stream_append_s8(&error_stream, s8("parse_term_bank: invalid entry: missing "));
+			if (!tdefs) stream_append_s8(&error_stream, s8("definition token\n"));
+			else        stream_append_s8(&error_stream, s8("name token\n"));
+			break;
+		}
+
+		s8 mem_term = {.len = tstr->end - tstr->start, .s = data.s + tstr->start};
+		DictEnt *e  = intern_ent(a, ht, normalize_term(scratch, mem_term));
+		if (!e->headword.len)
+			e->headword = s8_equal(e->term, mem_term) ? e->term : s8_dup(a, mem_term);
+
+		i32 score = 0;
+		if (tscore && tscore < tdefs)
+			score = parse_i32((s8){.len = tscore->end - tscore->start, .s = data.s + tscore->start});
+
+		/* NOTE: the definition tags and rules follow the reading and the term
+		 * tags follow the sequence number after the definitions */
+		u64 tags = 0;
+		YomiTok *tag_toks[] = {base_tok + 3, base_tok + 4, tdefs + tdefs->len + 2};
+		for (u32 j = 0; j < ARRAY_COUNT(tag_toks); j++) {
+			YomiTok *t = tag_toks[j];
+			if (t < toks + r && t->type == YOMI_STR && t->parent == i)
+				tags |= dict_tag_set(a, d, (s8){.len = t->end - t->start, .s = data.s + t->start});
+		}
+
+		for (usize i = 1; i <= tdefs->len; i++) {
+			DictDef *def = alloc(a, DictDef, 1, ARENA_NO_CLEAR);
+			def->text  = s8_dup(a, (s8){.len = tdefs[i].end - tdefs[i].start,
+			                            .s = data.s + tdefs[i].start});
+			def->bank  = bank;
+			def->score = score;
+			def->tags  = tags;
+			dict_def_insert(e->defs + list, def);
+		}
+	}
+	trace_end(entry_zone);
+	stats.banks_parsed++;
+
+cleanup:
+	stream_ensure_newline(&error_stream);
+}
+
+/* NOTE: invalid sequences decode one byte at a time */
+static u32
+utf8_next(s8 *s)
+{
+	u32 c = s->s[0], n = 0;
+	if      ((c & 0xE0) == 0xC0) { c &= 0x1F; n = 2; }
+	else if ((c & 0xF0) == 0xE0) { c &= 0x0F; n = 3; }
+	else if ((c & 0xF8) == 0xF0) { c &= 0x07; n = 4; }
+	for (u32 i = 1; n && i < n; i++) {
+		if (i >= s->len || (s->s[i] & 0xC0) != 0x80) n = 0;
+		else                                         c = (c << 6) | (s->s[i] & 0x3F);
+	}
+	if (!n) {
+		c = s->s[0];
+		n = 1;
+	}
+	*s = s8_cut_head(*s, n);
+	return c;
+}
+
+static KanjiEnt *
+kanji_lookup(KanjiIndex *ki, u32 c)
+{
+	u32 *page = c <= KANJI_CODEPOINT_MAX ? ki->pages[c >> KANJI_PAGE_BITS] : 0;
+	u32  slot = page ? page[c & ((1 << KANJI_PAGE_BITS) - 1)] : 0;
+	return slot ? ki->ents + slot - 1 : 0;
+}
+
+/* NOTE: entries of a kanji are chained in the order their dicts are parsed */
+static void
+kanji_index_push(Arena *a, KanjiIndex *ki, u32 c, KanjiEnt *ent)
+{
+	if (c > KANJI_CODEPOINT_MAX)
+		return;
+	if (ki->len == ki->cap) {
+		ki->cap        = ki->cap ? 2 * ki->cap : 4096;
+		KanjiEnt *ents = alloc(a, KanjiEnt, ki->cap, ARENA_NO_CLEAR);
+		for (u32 i = 0; i < ki->len; i++)
+			ents[i] = ki->ents[i];
+		ki->ents = ents;
+	}
+
+	u32 **page = ki->pages + (c >> KANJI_PAGE_BITS);
+	if (!*page)
+		*page = alloc(a, u32, 1 << KANJI_PAGE_BITS, 0);
+	u32 *slot = *page + (c & ((1 << KANJI_PAGE_BITS) - 1));
+	while (*slot)
+		slot = &ki->ents[*slot - 1].next;
+	ki->ents[ki->len++] = *ent;
+	*slot = ki->len;
+}
+
+/* NOTE: entries are [kanji, onyomi, kunyomi, tags, [meanings], {stats}];
+ * version 1 banks have the meanings inline after the tags and no stats */
+static void
+parse_kanji_bank(Arena *a, Arena *scratch, KanjiIndex *ki, s8 data, u32 dict)
+{
+	YomiTok *toks;
+	i32 r = lex_bank(scratch, data, &toks);
+
+	TraceZone zone = trace_begin(s8("parse_kanji_bank"), s8(""));
+	for (i32 i = 0; i < r; i++) {
+		if (toks[i].type != YOMI_ENTRY)
+			continue;
+
+		/* NOTE: the meanings array is the only child that has children */
+		s8  fields[4] = {0}, stats_obj = {0};
+		u32 nfields   = 0;
+		i32 end       = i + 1;
+		KanjiEnt ent  = {.dict = dict};
+		for (; end < r && toks[end].type != YOMI_ENTRY; end++) {
+			YomiTok *t = toks + end;
+			s8 text    = {.len = t->end - t->start, .s = data.s + t->start};
+			if      (t->parent != i)         ent.nmeanings += t->type == YOMI_STR;
+			else if (t->type == YOMI_OBJ)    stats_obj = text;
+			else if (t->type != YOMI_STR)    continue;
+			else if (nfields < 4)            fields[nfields++] = text;
+			else                             ent.nmeanings++;
+		}
+
+		s8  kanji = fields[0];
+		u32 c     = kanji.len ? utf8_next(&kanji) : 0;
+		if (!c || kanji.len) {
+			stream_append_s8(&error_stream, s8("parse_kanji_bank: invalid entry: "));
+			stream_append_s8(&error_stream, fields[0]);
+			stream_append_byte(&error_stream, '\n');
+			i = end - 1;
+			continue;
+		}
+
+		ent.kanji    = s8_dup(a, fields[0]);
+		ent.onyomi   = s8_dup(a, fields[1]);
+		ent.kunyomi  = s8_dup(a, fields[2]);
+		ent.tags     = s8_dup(a, fields[3]);
+		ent.meanings = alloc(a, s8, ent.nmeanings, ARENA_NO_CLEAR);
+		for (i32 j = i + 1, k = 0, field = 0; j < end; j++) {
+			YomiTok *t = toks + j;
+			if (t->type != YOMI_STR || (t->parent == i && field++ < 4))
+				continue;
+			ent.meanings[k++] = s8_dup(a, (s8){.len = t->end - t->start, .s = data.s + t->start});
+		}
+		if (stats_obj.len) {
+			s8 strokes = json_after_key(stats_obj, s8("\"strokes\""));
+			if (strokes.s) ent.strokes = parse_first_u32(strokes);
+		}
+
+		kanji_index_push(a, ki, c, &ent);
+		i = end - 1;
+	}
+	trace_end(zone);
+	stats.banks_parsed++;
+	stream_ensure_newline(&error_stream);
+}
+
+static u32
+dict_index(Dict *d)
+{
+	return d - default_dict_map;
+}
+
+static s8
+image_s8(u8 *base, DictImageString str)
+{
+	return (s8){.len = str.len, .s = base + str.offset};
+}
+
+static DictImageBank *
+image_banks(DictImageHeader *image, u64 **ranges)
+{
+	*ranges = (u64 *)((u8 *)image + image->banks);
+	return (DictImageBank *)(*ranges + image->ndicts + 1);
+}
+
+static DictImageString *
+image_tags(DictImageHeader *image, u64 **ranges)
+{
+	*ranges = (u64 *)((u8 *)image + image->tags);
+	return (DictImageString *)(*ranges + image->ndicts + 1);
+}
+
+static TagSet *
+image_tag_sets(DictImageHeader *image, u64 **ranges)
+{
+	*ranges = (u64 *)((u8 *)image + image->tag_sets);
+	return (TagSet *)(*ranges + image->ndicts + 1);
+}
+
+static ReverseIndex
+image_reverse_index(DictImageHeader *image)
+{
+	ReverseIndex result = {.exp = image->reverse_exp};
+	result.offsets  = (u32 *)((u8 *)image + image->reverse);
+	result.postings = (u8 *)(result.offsets + ((1u << result.exp) + 1));
+	return result;
+}
+
+static DictImageDefs
+image_entry_defs(DictImageEntry *e, u32 ndicts)
+{
+	u64 ndefs = e->defs[ndicts];
+	DictImageDefs result;
+	result.text   = (DictImageString *)(e->defs + ndicts + 1);
+	result.banks  = (u32 *)(result.text + ndefs);
+	result.scores = (i32 *)(result.banks + ndefs);
+	result.tags   = (u64 *)(result.scores + ndefs);
+	return result;
+}
+
+/* returns 1 if len bytes at offset lie inside of an image of size bytes */
+static b32
+image_fits(u64 size, u64 offset, u64 len, u64 align)
+{
+	return offset % align == 0 && offset <= size && len <= size - offset;
+}
+
+/* NOTE: images may be left by anyone who can write to image_dir so every
+ * offset and count is checked before it is followed. the header and the
+ * tables after it are checked once (dict_image_check); an entry is checked
+ * whole, along with its definitions, whenever it is reached from a slot */
+static DictImageEntry *
+image_entry(DictImageHeader *image, u64 offset)
+{
+	u32 ndicts = image->ndicts;
+	u64 fixed  = sizeof(DictImageEntry) + (ndicts + 1) * sizeof(u64);
+	if (!image_fits(image->size, offset, fixed, _Alignof(DictImageEntry)))
+		return 0;
+
+	u8 *base = (u8 *)image;
+	DictImageEntry *e = (DictImageEntry *)(base + offset);
+	u64 ndefs    = e->defs[ndicts];
+	u64 def_size = sizeof(DictImageString) + sizeof(u32) + sizeof(i32) + sizeof(u64);
+	if (ndefs > (image->size - offset - fixed) / def_size ||
+	    !image_fits(image->size, e->term.offset, e->term.len, 1) ||
+	    !image_fits(image->size, e->headword.offset, e->headword.len, 1))
+		return 0;
+
+	u64 *banks, *tags, *sets;
+	image_banks(image, &banks);
+	image_tags(image, &tags);
+	image_tag_sets(image, &sets);
+	for (u32 i = 0; i < ndicts; i++)
+		if (e->defs[i] > e->defs[i + 1])
+			return 0;
+	DictImageDefs defs = image_entry_defs(e, ndicts);
+	for (u32 i = 0; i < ndicts; i++) {
+		u64 ntags = tags[i + 1] - tags[i];
+		for (u64 k = e->defs[i]; k < e->defs[i + 1]; k++) {
+			u64 t = defs.tags[k];
+			if (!image_fits(image->size, defs.text[k].offset, defs.text[k].len, 1) ||
+			    defs.banks[k] >= banks[i + 1] - banks[i] ||
+			    ((t & TAG_WIDE) ? (t & ~TAG_WIDE) >= sets[i + 1] - sets[i]
+			                    : ntags < TAG_BITS - 1 && t >> ntags))
+				return 0;
+		}
+	}
+	return e;
+}
+
+/* NOTE: the tags named by -t in the tag table of d, or in that of d in the
+ * image serving lookups; tags d does not know match nothing */
+static TagSet *
+dict_tag_filter(Dict *d)
+{
+	if (d->tag_filter_resolved)
+		return &d->tag_filter;
+
+	TagSet result = {0};
+	for (s8 rest = tag_filter; rest.len;) {
+		s8 tag = {.s = rest.s};
+		for (; tag.len < rest.len && rest.s[tag.len] != ','; tag.len++);
+		rest = s8_cut_head(rest, MIN(rest.len, tag.len + 1));
+		if (dict_image) {
+			u64 *ranges;
+			DictImageString *names = image_tags(dict_image, &ranges);
+			u32 di = dict_index(d);
+			for (u64 i = ranges[di]; i < ranges[di + 1]; i++)
+				if (s8_equal(image_s8((u8 *)dict_image, names[i]), tag))
+					tag_set_add(&result, i - ranges[di]);
+		} else {
+			for (u32 i = 0; d->tags && i < d->tags->len; i++)
+				if (s8_equal(d->tags->names[i], tag))
+					tag_set_add(&result, i);
+		}
+	}
+	d->tag_filter          = result;
+	d->tag_filter_resolved = 1;
+	return &d->tag_filter;
+}
+
+/* returns the wide sets the tags of the definitions of d refer to */
+static TagSet *
+dict_tag_sets(Dict *d)
+{
+	if (dict_image) {
+		u64 *ranges;
+		TagSet *sets = image_tag_sets(dict_image, &ranges);
+		return sets + ranges[dict_index(d)];
+	}
+	return d->tags ? d->tags->sets : 0;
+}
+
+/* adds a bank to the manifest of d and returns 1 if its definitions can be
+ * copied from the image being replaced instead of being parsed */
+static b32
+dict_push_bank(Arena *a, Dict *d, s8 name, u64 size, u64 hash)
+{
+	if (d->nbanks == d->banks_cap) {
+		d->banks_cap   = d->banks_cap ? 2 * d->banks_cap : 64;
+		DictBank *banks = alloc(a, DictBank, d->banks_cap, ARENA_NO_CLEAR);
+		for (u32 i = 0; i < d->nbanks; i++)
+			banks[i] = d->banks[i];
+		d->banks = banks;
+	}
+	u32 bank = d->nbanks++;
+	d->banks[bank] = (DictBank){.name = s8_dup(a, name), .size = size, .hash = hash};
+
+	/* NOTE: frequencies are not kept per bank so meta banks are always parsed */
+	s8 meta = s8("term_meta");
+	DictImageHeader *image = dict_image_base.image;
+	if (!image || (name.len >= meta.len && s8_equal((s8){.len = meta.len, .s = name.s}, meta)))
+		return 0;
+
+	u64 *ranges;
+	DictImageBank *banks = image_banks(image, &ranges);
+	u32 di = dict_index(d);
+	for (u64 i = ranges[di]; i < ranges[di + 1]; i++) {
+		if (banks[i].size == size && banks[i].hash == hash &&
+		    dict_image_base.remap[i] == BANK_NONE &&
+		    s8_equal(image_s8((u8 *)image, banks[i].name), name)) {
+			dict_image_base.remap[i] = bank;
+			stats.banks_reused++;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static b32
+parse_should_yield(void)
+{
+	if (parse_yield && !parse_yielded && (os_wait_for_input(-1, 0) & OS_INPUT_READY))
+		parse_yielded = 1;
+	return parse_yielded;
+}
+
+/* NOTE: the directory state, read ahead buffers and each bank along with its
+ * tokens live in a scratch arena; a bank is returned to the OS as soon as it
+ * has been interned and the whole scratch arena once the dict is done */
+static void
+parse_dict_folder(Arena *a, Dict *d, struct ht *ht, u32 list)
+{
+	Stream path = {.cap = 1 * MEGABYTE};
+	Arena scratch = arena_new(0, path.cap);
+	path.data     = alloc(&scratch, u8, path.cap, ARENA_NO_CLEAR);
+
+	stream_append_s8(&path, prefix);
+	stream_append_s8(&path, os_path_sep);
+	stream_append_s8(&path, d->rom);
+	s8 match_prefix  = ht ? s8("term") : s8("kanji_bank");
+	TraceZone zone   = trace_begin(s8("os_begin_path_stream"), d->rom);
+	iptr path_stream = os_begin_path_stream(&path, match_prefix, &scratch, 0);
+	trace_end(zone);
+
+	while (!parse_should_yield()) {
+		Arena bank = scratch;
+		s8 name;
+		s8 filedata = os_get_valid_file(path_stream, &bank, 0, &name);
+		if (!filedata.len)
+			break;
+		if (!ht)
+			parse_kanji_bank(a, &bank, &kanji_index, filedata, list);
+		else if (!dict_push_bank(a, d, name, filedata.len, bank_hash(filedata)))
+			parse_term_bank(a, &bank, d, ht, filedata, list, d->nbanks - 1);
+		arena_release(scratch, &bank);
+	}
+	os_end_path_stream(path_stream);
+
+	arena_release((Arena){0}, &scratch);
+}
+
+/* NOTE: term banks are inflated straight into a scratch buffer of their
+ * uncompressed size which is released once the bank has been interned */
+static void
+parse_dict_archive(Arena *a, Dict *d, struct ht *ht, u32 list)
+{
+	Stream path = {.cap = 4096};
+	Arena scratch = arena_new(0, path.cap);
+	path.data     = alloc(&scratch, u8, path.cap, ARENA_NO_CLEAR);
+
+	stream_append_s8(&path, prefix);
+	stream_append_s8(&path, os_path_sep);
+	stream_append_s8(&path, d->rom);
+	stream_append_byte(&path, 0);
+
+	s8 archive = os_map_file((char *)path.data);
+	ZipReader zip;
+	if (!archive.len || zip_reader_init(&zip, archive.s, archive.len) < 0) {
+		stream_append_s8(&error_stream, s8("failed to open zip archive: "));
+		stream_append_s8(&error_stream, (s8){.len = path.widx - 1, .s = path.data});
+		die(&error_stream);
+	}
+
+	s8 match_prefix = ht ? s8("term") : s8("kanji_bank");
+	ZipEntry entry;
+	while (!parse_should_yield() && zip_next_entry(&zip, &entry)) {
+		s8 name = {.len = entry.name_len, .s = entry.name};
+		if (name.len < match_prefix.len ||
+		    !s8_equal((s8){.len = match_prefix.len, .s = name.s}, match_prefix))
+			continue;
+		/* NOTE: unchanged banks are not even inflated */
+		if (ht && dict_push_bank(a, d, name, entry.size, entry.crc32))
+			continue;
+
+		Arena bank = scratch;
+		s8 data    = {.len = entry.size, .s = alloc(&bank, u8, entry.size, ARENA_NO_CLEAR)};
+		TraceZone zone = trace_begin(s8("inflate"), name);
+		size inflated  = zip_extract(&zip, &entry, data.s);
+		trace_end(zone);
+		if (inflated < 0) {
+			stream_append_s8(&error_stream, s8("failed to extract: "));
+			stream_append_s8(&error_stream, name);
+			if (inflated == ZIP_ERROR_METHOD)
+				stream_append_s8(&error_stream, s8(" (unsupported compression)"));
+			stream_append_byte(&error_stream, '\n');
+		} else {
+			stats.bytes_read     += entry.compressed_size;
+			stats.bytes_inflated += inflated;
+			if (ht) parse_term_bank(a, &bank, d, ht, data, list, d->nbanks - 1);
+			else    parse_kanji_bank(a, &bank, &kanji_index, data, list);
+		}
+		arena_release(scratch, &bank);
+	}
+
+	os_unmap(archive.s, archive.len);
+	arena_release((Arena){0}, &scratch);
+}
+
+static b32
+dict_is_archive(Dict *d)
+{
+	s8 ext = s8(".zip");
+	return d->rom.len > ext.len &&
+	       s8_equal((s8){.len = ext.len, .s = d->rom.s + d->rom.len - ext.len}, ext);
+}
+
+/* NOTE: with ht unset the kanji banks of d are read into kanji_index instead
+ * of its term banks; they are not part of the manifest */
+static void
+parse_dict_banks(Arena *a, Dict *d, struct ht *ht, u32 list)
+{
+	TraceZone zone = trace_begin(ht ? s8("make_dict") : s8("make_kanji_index"), d->rom);
+	if (dict_is_archive(d)) parse_dict_archive(a, d, ht, list);
+	else                    parse_dict_folder(a, d, ht, list);
+	trace_end(zone);
+}
+
+static void
+parse_dict(Arena *a, Dict *d)
+{
+	d->ht.exp    = HT_EXP;
+	d->ht.nlists = 1;
+	d->ht.ents   = alloc(a, DictEnt *, 1 << d->ht.exp, 0);
+	parse_dict_banks(a, d, &d->ht, 0);
+}
+
+static int
+make_dict(Arena *a, Dict *d)
+{
+	/* NOTE: already built or served from a merged table or shared image */
+	if (d->ht.ents || merged_index.ents || dict_image)
+		return 1;
+	parse_dict(a, d);
+	return 1;
+}
+
+/* returns set with every bit b replaced by remap[b] as a tag set of d */
+static u64
+dict_image_remap_tags(Arena *a, Dict *d, TagSet *set, u32 *remap)
+{
+	TagSet result = {0};
+	for (u32 k = 0; k < TAG_WORDS; k++)
+		for (u64 bits = set->words[k]; bits; bits &= bits - 1)
+			tag_set_add(&result, remap[k * TAG_BITS + __builtin_ctzll(bits)]);
+	return tag_set_intern(a, d->tags, &result);
+}
+
+/* NOTE: copies the definitions of every reused bank of the image being
+ * replaced into t. they are visited from the back of each list so that
+ * dict_def_insert places them as if their banks had been parsed; the text is
+ * not copied and the image stays mapped */
+static void
+dict_image_patch(Arena *a, struct ht *t)
+{
+	DictImageHeader *image = dict_image_base.image;
+	u8  *base  = (u8 *)image;
+	u64 *slots = (u64 *)(base + image->slots);
+	u64 *ranges, *tag_ranges, *set_ranges;
+	image_banks(image, &ranges);
+
+	/* NOTE: the tags of the image are interned into the new tag tables and
+	 * tag_remap[i * TAG_NAMES + b] is the new bit of bit b of dict i. the
+	 * tables are usually empty until then so the bits rarely change and only
+	 * the wide sets have to be interned again (set_remap) */
+	DictImageString *tag_names = image_tags(image, &tag_ranges);
+	TagSet *image_sets         = image_tag_sets(image, &set_ranges);
+	u32 *tag_remap = alloc(a, u32, image->ndicts * TAG_NAMES, ARENA_NO_CLEAR);
+	u64 *set_remap = alloc(a, u64, set_ranges[image->ndicts], ARENA_NO_CLEAR);
+	b32 *same_bits = alloc(a, b32, image->ndicts, 0);
+	for (u32 i = 0; i < image->ndicts; i++) {
+		Dict *d      = default_dict_map + i;
+		same_bits[i] = 1;
+		for (u32 b = 0; b < TAG_NAMES; b++)
+			tag_remap[i * TAG_NAMES + b] = TAG_NAMES;
+		for (u64 k = tag_ranges[i]; k < tag_ranges[i + 1]; k++) {
+			if (!d->tags) d->tags = alloc(a, TagTable, 1, 0);
+			u32 bit = tag_intern(a, d->tags, image_s8(base, tag_names[k]));
+			tag_remap[i * TAG_NAMES + k - tag_ranges[i]] = bit;
+			same_bits[i] &= bit == k - tag_ranges[i];
+		}
+		for (u64 k = set_ranges[i]; k < set_ranges[i + 1]; k++)
+			set_remap[k] = dict_image_remap_tags(a, d, image_sets + k, tag_remap + i * TAG_NAMES);
+	}
+
+	TraceZone zone = trace_begin(s8("dict_image_patch"), s8(""));
+	for (u64 j = 0; j < (u64)1 << image->ht_exp; j++) {
+		DictImageEntry *e = slots[j] ? image_entry(image, slots[j]) : 0;
+		if (!e)
+			continue;
+		DictImageDefs defs = image_entry_defs(e, image->ndicts);
+
+		DictEnt **n = 0;
+		for (u32 i = 0; i < image->ndicts; i++) {
+			for (u64 k = e->defs[i + 1]; k > e->defs[i]; k--) {
+				u32 bank = dict_image_base.remap[ranges[i] + defs.banks[k - 1]];
+				if (bank == BANK_NONE)
+					continue;
+				if (!n) {
+					s8 term = image_s8(base, e->term);
+					n = intern(a, t, term);
+					if (!*n) {
+						*n = alloc_(a, sizeof(DictEnt) + t->nlists * sizeof(DictDef *),
+						            _Alignof(DictEnt), 1, 0);
+						(*n)->term     = term;
+						(*n)->headword = image_s8(base, e->headword);
+					}
+				}
+				DictDef *def = alloc(a, DictDef, 1, ARENA_NO_CLEAR);
+				def->text    = image_s8(base, defs.text[k - 1]);
+				def->bank    = bank;
+				def->score   = defs.scores[k - 1];
+				u64 tags     = defs.tags[k - 1];
+				if (tags & TAG_WIDE)
+					def->tags = set_remap[set_ranges[i] + (tags & ~TAG_WIDE)];
+				else if (same_bits[i])
+					def->tags = tags;
+				else
+					def->tags = dict_image_remap_tags(a, default_dict_map + i,
+					                                  &(TagSet){{tags}},
+					                                  tag_remap + i * TAG_NAMES);
+				dict_def_insert((*n)->defs + i, def);
+			}
+		}
+	}
+	trace_end(zone);
+}
+
+/* NOTE: the table grows with the number of dicts so that its fill stays close
+ * to that of a single dict table */
+static void
+make_merged_index(Arena *a, Dict *dicts, u32 ndicts)
+{
+	if (merged_index.ents || dict_image)
+		return;
+
+	merged_index.exp    = HT_EXP;
+	merged_index.nlists = ARRAY_COUNT(default_dict_map);
+	for (u32 n = 1; n < ndicts; n <<= 1)
+		merged_index.exp++;
+	merged_index.ents = alloc(a, DictEnt *, 1 << merged_index.exp, 0);
+
+	for (u32 i = 0; i < ndicts; i++)
+		if (!dicts[i].absent)
+			parse_dict_banks(a, dicts + i, &merged_index, dict_index(dicts + i));
+	if (dict_image_base.image)
+		dict_image_patch(a, &merged_index);
+}
+
+/* NOTE: links the lists of the tables of dicts, each parsed on its own, into
+ * merged_index so that they can be replaced one at a time. the lists are
+ * ranked up front; ranking a ranked list keeps its head so neither table is
+ * left holding a stale one when the other ranks it again */
+static void
+make_merged_view(Arena *a, Dict *dicts, u32 ndicts)
+{
+	merged_index.exp    = HT_EXP;
+	merged_index.nlists = ARRAY_COUNT(default_dict_map);
+	for (u32 n = 1; n < ndicts; n <<= 1)
+		merged_index.exp++;
+	merged_index.ents = alloc(a, DictEnt *, 1 << merged_index.exp, 0);
+
+	TraceZone zone = trace_begin(s8("make_merged_view"), s8(""));
+	for (u32 i = 0; i < ndicts; i++) {
+		struct ht *t = &dicts[i].ht;
+		u32 list     = dict_index(dicts + i);
+		for (u64 j = 0; t->ents && j < (u64)1 << t->exp; j++) {
+			DictEnt *e = t->ents[j];
+			if (!e)
+				continue;
+			e->defs[0]  = rank_defs(e->defs[0]);
+			DictEnt **n = intern(a, &merged_index, e->term);
+			if (!*n) {
+				*n = alloc_(a, sizeof(DictEnt) + merged_index.nlists * sizeof(DictDef *),
+				            _Alignof(DictEnt), 1, 0);
+				(*n)->term = e->term;
+			}
+			if (!(*n)->headword.len)
+				(*n)->headword = e->headword;
+			if (e->freq && (!(*n)->freq || e->freq < (*n)->freq))
+				(*n)->freq = e->freq;
+			(*n)->defs[list] = e->defs[0];
+		}
+	}
+	trace_end(zone);
+}
+
+static void
+make_dicts(Arena *a, Dict *dicts, u32 ndicts)
+{
+	for (u32 i = 0; i < ndicts; i++) {
+		if (!make_dict(a, &dicts[i])) {
+			stream_append_s8(&error_stream, s8("make_dict failed for: "));
+			stream_append_s8(&error_stream, dicts[i].rom);
+			stream_append_byte(&error_stream, '\n');
+		}
+	}
+}
+
+/* NOTE: kanji banks are always read from the dictionary folders; they are
+ * small and never stored in an image */
+static void
+make_kanji_index(Arena *a, Dict *dicts, u32 ndicts)
+{
+	if (kanji_index.built)
+		return;
+	for (u32 i = 0; i < ndicts; i++)
+		parse_dict_banks(a, dicts + i, 0, dict_index(dicts + i));
+	kanji_index.built = 1;
+}
+
+/* NOTE: with ti->text unset only the sizes are accumulated */
+static void
+term_index_push(TermIndex *ti, s8 term)
+{
+	if (ti->text) {
+		ti->starts[ti->nterms] = ti->len;
+		for (size i = 0; i < term.len; i++)
+			ti->text[ti->len + i] = term.s[i];
+		ti->text[ti->len + term.len] = 0;
+	}
+	ti->len += term.len + 1;
+	ti->nterms++;
+}
+
+/* NOTE: terms only known from a meta bank have no definitions to match */
+static b32
+ent_has_defs(DictEnt *e, u32 nlists)
+{
+	b32 result = 0;
+	for (u32 j = 0; e && j < nlists; j++)
+		result |= e->defs[j] != 0;
+	return result;
+}
+
+static void
+term_index_push_table(TermIndex *ti, struct ht *t)
+{
+	for (u64 i = 0; i < (u64)1 << t->exp; i++)
+		if (ent_has_defs(t->ents[i], t->nlists))
+			term_index_push(ti, t->ents[i]->term);
+}
+
+static void
+term_index_push_terms(TermIndex *ti, Dict *dicts, u32 ndicts)
+{
+	ti->len    = 1;
+	ti->nterms = 0;
+	if (dict_image) {
+		u8  *base  = (u8 *)dict_image;
+		u64 *slots = (u64 *)(base + dict_image->slots);
+		for (u64 i = 0; i < (u64)1 << dict_image->ht_exp; i++) {
+			DictImageEntry *e = slots[i] ? image_entry(dict_image, slots[i]) : 0;
+			if (e && e->defs[dict_image->ndicts])
+				term_index_push(ti, image_s8(base, e->term));
+		}
+	} else if (merged_index.ents) {
+		term_index_push_table(ti, &merged_index);
+	} else {
+		for (u32 i = 0; i < ndicts; i++)
+			term_index_push_table(ti, &dicts[i].ht);
+	}
+}
+
+/* NOTE: the id of the term containing text offset p */
+static i32
+term_index_id(TermIndex *ti, i32 p)
+{
+	i32 l = 0, r = ti->nterms;
+	while (r - l > 1) {
+		i32 m = l + (r - l) / 2;
+		if (ti->starts[m] <= p) l = m;
+		else                    r = m;
+	}
+	return l;
+}
+
+static s8
+term_index_term(TermIndex *ti, i32 id)
+{
+	i32 end = id + 1 < ti->nterms ? ti->starts[id + 1] : ti->len;
+	return (s8){.len = end - ti->starts[id] - 1, .s = ti->text + ti->starts[id]};
+}
+
+/* NOTE: the tables must already be built; the suffix array is constructed in
+ * a scratch arena that is returned to the OS once it is done */
+static void
+make_term_index(Arena *a, Dict *dicts, u32 ndicts)
+{
+	TermIndex *ti = &term_index;
+	if (ti->sa)
+		return;
+
+	TraceZone zone = trace_begin(s8("make_term_index"), s8(""));
+	term_index_push_terms(ti, dicts, ndicts);
+	ti->text    = alloc(a, u8,  ti->len,    ARENA_NO_CLEAR);
+	ti->starts  = alloc(a, i32, ti->nterms, ARENA_NO_CLEAR);
+	ti->text[0] = 0;
+	term_index_push_terms(ti, dicts, ndicts);
+
+	ti->sa = alloc(a, i32, ti->len, ARENA_NO_CLEAR);
+	Arena scratch = arena_new(0, SUFFIX_WORK_SIZE(ti->len));
+	suffix_array(ti->sa, ti->text, ti->len, scratch.beg);
+	arena_release((Arena){0}, &scratch);
+
+	/* NOTE: the suffixes at the 0 before each term are in term order */
+	ti->sorted = alloc(a, i32, ti->nterms, ARENA_NO_CLEAR);
+	ti->marks  = alloc(a, u8,  ti->nterms, 0);
+	for (i32 i = 0, j = 0; i < ti->len && j < ti->nterms; i++) {
+		i32 p = ti->sa[i];
+		if (ti->text[p] == 0 && p + 1 < ti->len)
+			ti->sorted[j++] = term_index_id(ti, p + 1);
+	}
+	trace_end(zone);
+}
+
+/* NOTE: keys of the reverse index: runs of ASCII letters and digits are words
+ * and every other code point is a key on its own and paired with the code
+ * point before it. words have the top bit set so they never collide */
+#define REVERSE_WORD_BIT   (1ULL << 63)
+#define REVERSE_GRAM(a, b) ((u64)(a) << 21 | (b))
+#define REVERSE_PREFETCH   16
+
+/* NOTE: text is folded like terms with ASCII lowered and escapes blanked */
+static s8
+reverse_fold(Arena *a, s8 text)
+{
+	s8 result = normalize_term(a, text);
+	for (size i = 0; i < result.len; i++) {
+		u8 c = result.s[i];
+		if (c == '\\' && i + 1 < result.len) {
+			result.s[i++] = ' ';
+			result.s[i]   = ' ';
+		} else if (c >= 'A' && c <= 'Z') {
+			result.s[i] = c + ('a' - 'A');
+		}
+	}
+	return result;
+}
+
+/* fills keys (room for text.len + 1) and returns how many were written; for
+ * queries a code point is only used alone when it has no neighbour to pair with */
+static size
+reverse_keys(s8 text, u64 *keys, b32 query)
+{
+	size n = 0, run = 0;
+	u32 prev = 0;
+	for (size i = 0; i <= text.len;) {
+		u8  c   = i < text.len ? text.s[i] : 0;
+		u32 cp  = 0;
+		u32 len = 0;
+		if      ((c & 0xE0) == 0xC0) { cp = c & 0x1F; len = 2; }
+		else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; len = 3; }
+		else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; len = 4; }
+		if (i + len > (size)text.len) len = 0;
+		for (u32 j = 1; j < len; j++)
+			cp = (cp << 6) | (text.s[i + j] & 0x3F);
+
+		if (len) {
+			if (!query)  keys[n++] = REVERSE_GRAM(cp, 0);
+			if (prev)    keys[n++] = REVERSE_GRAM(prev, cp);
+			prev = cp;
+			run++;
+			i += len;
+			continue;
+		}
+
+		if (query && run == 1) keys[n++] = REVERSE_GRAM(prev, 0);
+		prev = 0;
+		run  = 0;
+
+		s8 word = {.s = text.s + i};
+		while (i + word.len < text.len) {
+			u8 w = text.s[i + word.len];
+			if ((w < 'a' || w > 'z') && (w < '0' || w > '9')) break;
+			word.len++;
+		}
+		if (word.len) keys[n++] = hash(word) | REVERSE_WORD_BIT;
+		i += word.len ? word.len : 1;
+	}
+	return n;
+}
+
+static u32
+reverse_bucket(ReverseIndex *ri, u64 key)
+{
+	return (key * 1111111111111111111) >> (64 - ri->exp);
+}
+
+static u32
+varint_size(u32 v)
+{
+	u32 result = 1;
+	while (v >= 0x80) { v >>= 7; result++; }
+	return result;
+}
+
+/* NOTE: terms are numbered in the order term_index_push_terms visits them and
+ * all of the definitions of a term are scanned when it is reached so that ids
+ * are added to each bucket in increasing order. the first pass only sizes the
+ * postings and the second writes them */
+static void
+reverse_index_scan(Arena scratch, ReverseIndex *ri, ReverseBucket *buckets,
+                   struct ht **tables, u32 ntables, b32 write)
+{
+	u32 id = 0;
+	for (u32 t = 0; t < ntables; t++) {
+		struct ht *ht = tables[t];
+		for (u64 j = 0; ht->ents && j < (u64)1 << ht->exp; j++) {
+			DictEnt *e = ht->ents[j];
+			if (!ent_has_defs(e, ht->nlists))
+				continue;
+			id++;
+			for (u32 l = 0; l < ht->nlists; l++) {
+				for (DictDef *def = e->defs[l]; def; def = def->next) {
+					Arena tmp  = scratch;
+					s8 text    = reverse_fold(&tmp, def->text);
+					u64 *keys  = alloc(&tmp, u64, text.len + 1, ARENA_NO_CLEAR);
+					size nkeys = reverse_keys(text, keys, 0);
+					for (size k = 0; k < nkeys; k++)
+						keys[k] = reverse_bucket(ri, keys[k]);
+
+					/* NOTE: buckets are hit at random; fetch them ahead */
+					for (size k = 0; k < nkeys; k++) {
+						if (k + REVERSE_PREFETCH < (size)nkeys)
+							__builtin_prefetch(buckets + keys[k + REVERSE_PREFETCH]);
+						ReverseBucket *b = buckets + keys[k];
+						if (b->last == id)
+							continue;
+						u32 delta = id - b->last;
+						b->last   = id;
+						if (write) {
+							u8 *out = ri->postings + b->offset;
+							for (; delta >= 0x80; delta >>= 7)
+								*out++ = 0x80 | (delta & 0x7F);
+							*out++    = delta;
+							b->offset = out - ri->postings;
+						} else {
+							b->offset += varint_size(delta);
+						}
+					}
+					arena_rewind(&tmp, scratch);
+				}
+			}
+		}
+	}
+}
+
+/* NOTE: indexes the definitions of tables; there are about eight buckets per
+ * term and the postings are limited to 4GB */
+static void
+reverse_index_build(Arena *a, ReverseIndex *ri, struct ht **tables, u32 ntables)
+{
+	TraceZone zone = trace_begin(s8("reverse_index_build"), s8(""));
+	u32 nterms = 0;
+	for (u32 t = 0; t < ntables; t++)
+		for (u64 j = 0; tables[t]->ents && j < (u64)1 << tables[t]->exp; j++)
+			nterms += ent_has_defs(tables[t]->ents[j], tables[t]->nlists);
+
+	for (ri->exp = 16; ri->exp < 28 && (1u << ri->exp) < 8u * nterms; ri->exp++);
+	u32 nbuckets = 1u << ri->exp;
+	Arena scratch = arena_new(0, nbuckets * sizeof(ReverseBucket));
+	ReverseBucket *buckets = alloc(&scratch, ReverseBucket, nbuckets, 0);
+	reverse_index_scan(scratch, ri, buckets, tables, ntables, 0);
+
+	ri->offsets = alloc(a, u32, nbuckets + 1, ARENA_NO_CLEAR);
+	u32 total = 0;
+	for (u32 i = 0; i < nbuckets; i++) {
+		u32 len = buckets[i].offset;
+		buckets[i].offset = total;
+		buckets[i].last   = 0;
+		ri->offsets[i]    = total;
+		total += len;
+	}
+	ri->offsets[nbuckets] = total;
+	ri->postings = alloc(a, u8, total, ARENA_NO_CLEAR);
+	reverse_index_scan(scratch, ri, buckets, tables, ntables, 1);
+
+	arena_release((Arena){0}, &scratch);
+	trace_end(zone);
+}
+
+/* returns the distinct marked terms in lexicographic order and clears the marks */
+static s8 *
+term_index_take_marked(Arena *a, i32 nmarked, i32 *count)
+{
+	TermIndex *ti = &term_index;
+	s8 *result = alloc(a, s8, nmarked, ARENA_NO_CLEAR);
+	*count = 0;
+	for (i32 i = 0; nmarked && i < ti->nterms; i++) {
+		i32 id = ti->sorted[i];
+		if (ti->marks[id]) {
+			s8 term = term_index_term(ti, id);
+			/* NOTE: per dict tables can hold the same term more than once */
+			if (!*count || !s8_equal(result[*count - 1], term))
+				result[(*count)++] = term;
+			ti->marks[id] = 0;
+			nmarked--;
+		}
+	}
+	return result;
+}
+
+static b32
+is_glob(s8 term)
+{
+	for (size i = 0; i < term.len; i++)
+		if (term.s[i] == '*') return 1;
+	return 0;
+}
+
+/* NOTE: '*' matches any run of bytes */
+static b32
+glob_match(s8 pattern, s8 str)
+{
+	size p = 0, s = 0, star = -1, mark = 0;
+	while (s < str.len) {
+		if (p < pattern.len && pattern.s[p] == '*') {
+			star = p++;
+			mark = s;
+		} else if (p < pattern.len && pattern.s[p] == str.s[s]) {
+			p++;
+			s++;
+		} else if (star >= 0) {
+			p = star + 1;
+			s = ++mark;
+		} else {
+			return 0;
+		}
+	}
+	while (p < pattern.len && pattern.s[p] == '*') p++;
+	return p == pattern.len;
+}
+
+/* returns the distinct terms matching pattern in lexicographic order. the
+ * longest literal run of the pattern is looked up in the suffix array (with
+ * the separating 0 when it is at either end) and the terms found are then
+ * checked against the whole pattern */
+static s8 *
+expand_glob(Arena *a, s8 pattern, i32 *count)
+{
+	TermIndex *ti = &term_index;
+
+	size best = 0, best_len = 0;
+	for (size i = 0, start = 0; i <= pattern.len; i++) {
+		if (i == pattern.len || pattern.s[i] == '*') {
+			if (i - start > best_len) {
+				best     = start;
+				best_len = i - start;
+			}
+			start = i + 1;
+		}
+	}
+
+	i32 nmarked = 0;
+	if (best_len == 0) {
+		for (i32 i = 0; i < ti->nterms; i++)
+			ti->marks[i] = 1;
+		nmarked = ti->nterms;
+	} else {
+		b32 head = best == 0, tail = best + best_len == (size)pattern.len;
+		s8 key   = {.len = head + best_len + tail};
+		key.s    = alloc(a, u8, key.len, 0);
+		for (size i = 0; i < best_len; i++)
+			key.s[head + i] = pattern.s[best + i];
+
+		i32 lo, hi;
+		suffix_range(ti->text, ti->sa, ti->len, key, &lo, &hi);
+		for (i32 i = lo; i < hi; i++) {
+			i32 id = term_index_id(ti, ti->sa[i] + head);
+			if (!ti->marks[id] && glob_match(pattern, term_index_term(ti, id))) {
+				ti->marks[id] = 1;
+				nmarked++;
+			}
+		}
+	}
+
+	return term_index_take_marked(a, nmarked, count);
+}
+
+
+static void
+dict_image_path(Stream *path, u64 key)
+{
+	static u8 hex[] = "0123456789abcdef";
+	stream_append_s8(path, image_dir);
+	stream_append_s8(path, os_path_sep);
+	stream_append_s8(path, s8("jdict-"));
+	for (u32 i = 0; i < 16; i++)
+		stream_append_byte(path, hex[(key >> (60 - 4 * i)) & 0xF]);
+	stream_append_s8(path, s8(".img"));
+	stream_append_byte(path, 0);
+}
+
+/* returns a hash of the names, sizes and modification times of the term
+ * banks of d or 0 if it has none */
+static u64
+dict_fingerprint(Arena *a, Dict *d)
+{
+	Arena tmp   = *a;
+	Stream path = {.cap = 4096};
+	path.data   = alloc(&tmp, u8, path.cap, ARENA_NO_CLEAR);
+	stream_append_s8(&path, prefix);
+	stream_append_s8(&path, os_path_sep);
+	stream_append_s8(&path, d->rom);
+	stream_append_byte(&path, 0);
+	u64 result = os_dir_fingerprint((char *)path.data, s8("term"));
+	arena_rewind(&tmp, *a);
+	return result;
+}
+
+/* NOTE: hashes the term banks of every dict so that an image is rebuilt
+ * whenever any of its sources change, or a missing dict appears */
+static u64
+dict_image_source_hash(Arena *a, Dict *dicts, u32 ndicts)
+{
+	u64 result = DICT_IMAGE_VERSION;
+	for (u32 i = 0; i < ndicts; i++) {
+		result = result * 1111111111111111111 + hash(dicts[i].rom);
+		result = result * 1111111111111111111 + dict_fingerprint(a, dicts + i);
+	}
+	return result;
+}
+
+static DictImageString
+dict_image_push_s8(Arena *a, u8 *base, s8 str)
+{
+	DictImageString result = {.len = str.len};
+	u8 *dst = alloc(a, u8, str.len, ARENA_NO_CLEAR);
+	result.offset = dst - base;
+	simd.copy(dst, str.s, str.len);
+	return result;
+}
+
+/* upper bound on the size of the image dict_image_build makes from t and its
+ * reverse index ri */
+static size
+dict_image_size(struct ht *t, Dict *dicts, u32 ndicts, ReverseIndex *ri)
+{
+	size align  = _Alignof(DictImageEntry) - 1;
+	size result = sizeof(DictImageHeader) + ndicts * sizeof(DictImageString) + align;
+	result += (ndicts + 1) * sizeof(u64) + align;
+	for (u32 i = 0; i < ndicts; i++) {
+		result += dicts[i].rom.len;
+		for (u32 j = 0; j < dicts[i].nbanks; j++)
+			result += sizeof(DictImageBank) + dicts[i].banks[j].name.len + align;
+		for (u32 j = 0; dicts[i].tags && j < dicts[i].tags->len; j++)
+			result += sizeof(DictImageString) + dicts[i].tags->names[j].len;
+		if (dicts[i].tags)
+			result += dicts[i].tags->nsets * sizeof(TagSet);
+	}
+	result += 2 * (ndicts + 1) * sizeof(u64) + align;
+	result += ((size)1 << t->exp) * sizeof(u64) + align;
+	for (size j = 0; j < (size)1 << t->exp; j++) {
+		DictEnt *ent = t->ents[j];
+		if (!ent)
+			continue;
+		result += sizeof(DictImageEntry) + (ndicts + 1) * sizeof(u64) + align + ent->term.len;
+		result += ent->headword.len;
+		for (u32 i = 0; i < ndicts; i++)
+			for (DictDef *def = ent->defs[i]; def; def = def->next)
+				result += sizeof(DictImageString) + sizeof(u32) + sizeof(i32) + sizeof(u64)
+				          + def->text.len;
+	}
+	u32 nbuckets = 1u << ri->exp;
+	result += (nbuckets + 1) * sizeof(u32) + ri->offsets[nbuckets] + align;
+	return result;
+}
+
+/* serializes the merged table into a single contiguous region at the start of
+ * the arena which must be large enough to hold all of it (see dict_image_size) */
+static s8
+dict_image_build(Arena *a, struct ht *t, Dict *dicts, u32 ndicts, ReverseIndex *ri,
+                 u64 source_hash)
+{
+	size header_size = sizeof(DictImageHeader) + ndicts * sizeof(DictImageString);
+	DictImageHeader *header = alloc_(a, header_size, _Alignof(DictImageHeader), 1, 0);
+	u8 *base = (u8 *)header;
+
+	header->magic       = DICT_IMAGE_MAGIC;
+	header->version     = DICT_IMAGE_VERSION;
+	header->ndicts      = ndicts;
+	header->source_hash = source_hash;
+	header->ht_exp      = t->exp;
+	header->ht_len      = t->len;
+	for (u32 i = 0; i < ndicts; i++)
+		header->roms[i] = dict_image_push_s8(a, base, dicts[i].rom);
+
+	u32 nbanks = 0;
+	for (u32 i = 0; i < ndicts; i++)
+		nbanks += dicts[i].nbanks;
+	u64 *ranges = alloc_(a, (ndicts + 1) * sizeof(u64) + nbanks * sizeof(DictImageBank),
+	                     _Alignof(DictImageBank), 1, 0);
+	DictImageBank *banks = (DictImageBank *)(ranges + ndicts + 1);
+	header->banks        = (u8 *)ranges - base;
+	for (u32 i = 0; i < ndicts; i++) {
+		ranges[i + 1] = ranges[i] + dicts[i].nbanks;
+		for (u32 j = 0; j < dicts[i].nbanks; j++) {
+			DictBank *b = dicts[i].banks + j;
+			banks[ranges[i] + j] = (DictImageBank){.size = b->size, .hash = b->hash};
+			banks[ranges[i] + j].name = dict_image_push_s8(a, base, b->name);
+		}
+	}
+
+	u32 ntags = 0;
+	for (u32 i = 0; i < ndicts; i++)
+		ntags += dicts[i].tags ? dicts[i].tags->len : 0;
+	u64 *tag_ranges = alloc_(a, (ndicts + 1) * sizeof(u64) + ntags * sizeof(DictImageString),
+	                         _Alignof(DictImageString), 1, 0);
+	DictImageString *tag_names = (DictImageString *)(tag_ranges + ndicts + 1);
+	header->tags               = (u8 *)tag_ranges - base;
+	for (u32 i = 0; i < ndicts; i++) {
+		TagTable *tt      = dicts[i].tags;
+		tag_ranges[i + 1] = tag_ranges[i] + (tt ? tt->len : 0);
+		for (u32 j = 0; tt && j < tt->len; j++)
+			tag_names[tag_ranges[i] + j] = dict_image_push_s8(a, base, tt->names[j]);
+	}
+
+	u32 nsets = 0;
+	for (u32 i = 0; i < ndicts; i++)
+		nsets += dicts[i].tags ? dicts[i].tags->nsets : 0;
+	u64 *set_ranges = alloc_(a, (ndicts + 1) * sizeof(u64) + nsets * sizeof(TagSet),
+	                         _Alignof(TagSet), 1, 0);
+	TagSet *sets       = (TagSet *)(set_ranges + ndicts + 1);
+	header->tag_sets   = (u8 *)set_ranges - base;
+	for (u32 i = 0; i < ndicts; i++) {
+		TagTable *tt      = dicts[i].tags;
+		set_ranges[i + 1] = set_ranges[i] + (tt ? tt->nsets : 0);
+		for (u32 j = 0; tt && j < tt->nsets; j++)
+			sets[set_ranges[i] + j] = tt->sets[j];
+	}
+
+	u64 *slots     = alloc(a, u64, 1 << t->exp, 0);
+	header->slots  = (u8 *)slots - base;
+	for (u32 j = 0; j < (u32)1 << t->exp; j++) {
+		DictEnt *ent = t->ents[j];
+		if (!ent)
+			continue;
+
+		u64 ndefs = 0;
+		for (u32 i = 0; i < ndicts; i++) {
+			ent->defs[i] = rank_defs(ent->defs[i]);
+			for (DictDef *def = ent->defs[i]; def; def = def->next)
+				ndefs++;
+		}
+
+		size entry_size   = sizeof(DictImageEntry) + (ndicts + 1) * sizeof(u64)
+		                    + ndefs * (sizeof(DictImageString) + sizeof(u32) + sizeof(i32)
+		                               + sizeof(u64));
+		DictImageEntry *e = alloc_(a, entry_size, _Alignof(DictImageEntry), 1, ARENA_NO_CLEAR);
+		e->defs[ndicts]    = ndefs;
+		DictImageDefs defs = image_entry_defs(e, ndicts);
+		slots[j] = (u8 *)e - base;
+		e->term  = dict_image_push_s8(a, base, ent->term);
+		e->freq  = ent->freq;
+		/* NOTE: most headwords are already normalized and share the term */
+		e->headword = e->term;
+		if (!s8_equal(ent_headword(ent), ent->term))
+			e->headword = dict_image_push_s8(a, base, ent->headword);
+		u64 k = 0;
+		for (u32 i = 0; i < ndicts; i++) {
+			e->defs[i] = k;
+			for (DictDef *def = ent->defs[i]; def; def = def->next) {
+				defs.banks[k]  = def->bank;
+				defs.scores[k] = def->score;
+				defs.tags[k]   = def->tags;
+				defs.text[k++] = dict_image_push_s8(a, base, def->text);
+			}
+		}
+		e->defs[ndicts] = k;
+	}
+
+	u32 nbuckets = 1u << ri->exp;
+	u32 *offsets = alloc(a, u32, nbuckets + 1, ARENA_NO_CLEAR);
+	u8 *postings = alloc(a, u8, ri->offsets[nbuckets], ARENA_NO_CLEAR);
+	header->reverse     = (u8 *)offsets - base;
+	header->reverse_exp = ri->exp;
+	simd.copy((u8 *)offsets, (u8 *)ri->offsets, (nbuckets + 1) * sizeof(u32));
+	simd.copy(postings, ri->postings, ri->offsets[nbuckets]);
+
+	header->size = a->beg - base;
+
+	return (s8){.len = header->size, .s = base};
+}
+
+/* returns 1 if the ndicts + 1 ascending indices at offset and the items
+ * they index, which follow them, lie inside of image */
+static b32
+image_ranges_fit(s8 image, u64 offset, u32 ndicts, u64 item_size)
+{
+	u64 index_size = (ndicts + 1) * sizeof(u64);
+	if (!image_fits(image.len, offset, index_size, sizeof(u64)))
+		return 0;
+	u64 *ranges = (u64 *)(image.s + offset);
+	for (u32 i = 0; i < ndicts; i++)
+		if (ranges[i] > ranges[i + 1])
+			return 0;
+	return ranges[0] == 0 &&
+	       ranges[ndicts] <= (image.len - offset - index_size) / item_size;
+}
+
+/* returns image as a header if it was built from dicts. entries are checked
+ * as they are reached (see image_entry) */
+static DictImageHeader *
+dict_image_check(s8 image, Dict *dicts, u32 ndicts)
+{
+	DictImageHeader *header = (DictImageHeader *)image.s;
+	if (image.len < (size)(sizeof(*header) + ndicts * sizeof(DictImageString)) ||
+	    header->magic       != DICT_IMAGE_MAGIC    ||
+	    header->version     != DICT_IMAGE_VERSION  ||
+	    header->size        != (u64)image.len      ||
+	    header->ndicts      != ndicts              ||
+	    header->ht_exp == 0 || header->ht_exp > 31 ||
+	    header->ht_len > (u64)1 << header->ht_exp  ||
+	    header->reverse_exp < 16 || header->reverse_exp > 28 ||
+	    !image_fits(image.len, header->slots, sizeof(u64) << header->ht_exp, sizeof(u64)) ||
+	    !image_fits(image.len, header->reverse,
+	                ((1u << header->reverse_exp) + 1) * sizeof(u32), sizeof(u32)) ||
+	    !image_ranges_fit(image, header->banks,    ndicts, sizeof(DictImageBank))   ||
+	    !image_ranges_fit(image, header->tags,     ndicts, sizeof(DictImageString)) ||
+	    !image_ranges_fit(image, header->tag_sets, ndicts, sizeof(TagSet)))
+		return 0;
+
+	for (u32 i = 0; i < ndicts; i++) {
+		DictImageString rom = header->roms[i];
+		if (!image_fits(image.len, rom.offset, rom.len, 1) ||
+		    !s8_equal(image_s8(image.s, rom), dicts[i].rom))
+			return 0;
+	}
+
+	u64 *ranges;
+	DictImageBank *banks = image_banks(header, &ranges);
+	for (u64 i = 0; i < ranges[ndicts]; i++)
+		if (!image_fits(image.len, banks[i].name.offset, banks[i].name.len, 1))
+			return 0;
+	DictImageString *names = image_tags(header, &ranges);
+	for (u32 i = 0; i < ndicts; i++)
+		if (ranges[i + 1] - ranges[i] > TAG_NAMES)
+			return 0;
+	for (u64 i = 0; i < ranges[ndicts]; i++)
+		if (!image_fits(image.len, names[i].offset, names[i].len, 1))
+			return 0;
+
+	/* NOTE: the buckets themselves are checked as they are used (see expand_reverse) */
+	ReverseIndex ri = image_reverse_index(header);
+	u64 postings    = ri.postings - image.s;
+	if (ri.offsets[1u << ri.exp] > image.len - postings)
+		return 0;
+
+	return header;
+}
+
+/* maps a previously published image of dicts which may be out of date */
+static DictImageHeader *
+dict_image_map(Arena *a, Dict *dicts, u32 ndicts, u64 key)
+{
+	Arena tmp   = *a;
+	Stream path = {.cap = 4096};
+	path.data   = alloc(&tmp, u8, path.cap, ARENA_NO_CLEAR);
+	dict_image_path(&path, key);
+
+	s8 image = os_map_private_file((char *)path.data);
+	arena_rewind(&tmp, *a);
+	DictImageHeader *header = dict_image_check(image, dicts, ndicts);
+	if (!header && image.s)
+		os_unmap(image.s, image.len);
+	return header;
+}
+
+/* maps a previously published image if it is up to date with the term
+ * banks on disk */
+static DictImageHeader *
+dict_image_attach(Arena *a, Dict *dicts, u32 ndicts, u64 key, u64 source_hash)
+{
+	DictImageHeader *result = dict_image_map(a, dicts, ndicts, key);
+	if (result && result->source_hash != source_hash) {
+		os_unmap(result, result->size);
+		result = 0;
+	}
+	return result;
+}
+
+/* serializes the merged table and its reverse index to path; both are
+ * released once it has been written */
+static b32
+dict_image_write(Arena *a, Dict *dicts, u32 ndicts, char *path, u64 source_hash)
+{
+	TraceZone zone = trace_begin(s8("dict_image_write"), s8(""));
+	Arena tmp = *a;
+	ReverseIndex reverse = {0};
+	struct ht *tables[] = {&merged_index};
+	reverse_index_build(&tmp, &reverse, tables, ARRAY_COUNT(tables));
+
+	size image_size = dict_image_size(&merged_index, dicts, ndicts, &reverse);
+	Arena image_arena = tmp;
+	image_arena.beg   = alloc(&tmp, u8, image_size, ARENA_NO_CLEAR);
+	image_arena.end   = image_arena.beg + image_size;
+	s8 image = dict_image_build(&image_arena, &merged_index, dicts, ndicts, &reverse,
+	                            source_hash);
+	b32 result = os_publish_file(path, image);
+	if (!result) {
+		stream_append_s8(&error_stream, s8("failed to write dictionary image: "));
+		stream_append_s8(&error_stream, cstr_to_s8(path));
+		stream_append_byte(&error_stream, '\n');
+	}
+	arena_release(*a, &tmp);
+	trace_end(zone);
+	return result;
+}
+
+/* builds the merged table and publishes it for other processes. when set
+ * only the banks that changed since stale was built are parsed. dicts without
+ * term banks are left empty instead of failing the whole image */
+static b32
+dict_image_publish(Arena *a, Dict *dicts, u32 ndicts, u64 key, u64 source_hash,
+                   DictImageHeader *stale)
+{
+	for (u32 i = 0; i < ndicts; i++)
+		dicts[i].absent = !dict_fingerprint(a, dicts + i);
+	if (stale) {
+		u64 *ranges;
+		image_banks(stale, &ranges);
+		dict_image_base.image = stale;
+		dict_image_base.remap = alloc(a, u32, ranges[stale->ndicts], ARENA_NO_CLEAR);
+		mem_clear(dict_image_base.remap, 0xFF, ranges[stale->ndicts] * sizeof(u32));
+	}
+	make_merged_index(a, dicts, ndicts);
+
+	Arena tmp = *a;
+	Stream path = {.cap = 4096};
+	path.data   = alloc(&tmp, u8, path.cap, ARENA_NO_CLEAR);
+	dict_image_path(&path, key);
+	b32 result = dict_image_write(&tmp, dicts, ndicts, (char *)path.data, source_hash);
+	arena_release(*a, &tmp);
+	return result;
+}
+
+static u64
+dict_image_key(void)
+{
+	u64 result = hash(prefix);
+	for (u32 i = 0; i < ARRAY_COUNT(default_dict_map); i++)
+		result = result * 1111111111111111111 + hash(default_dict_map[i].rom);
+	return result;
+}
+
+/* NOTE: images contain every configured dictionary so that any subset selected
+ * with -d can be served from the same image. no image is used while one of
+ * the selected dictionaries has no term banks; they are then read on their
+ * own and a missing one is reported the same way as without an image. the
+ * merged table is kept when the image can not be written */
+static void
+load_shared_image(Arena *a, Dict *selected, u32 nselected)
+{
+	Dict *dicts  = default_dict_map;
+	u32   ndicts = ARRAY_COUNT(default_dict_map);
+	u64   key    = dict_image_key();
+
+	for (u32 i = 0; i < nselected; i++)
+		if (!dict_fingerprint(a, selected + i))
+			return;
+
+	TraceZone zone = trace_begin(s8("load_shared_image"), s8(""));
+	u64 source_hash = dict_image_source_hash(a, dicts, ndicts);
+	DictImageHeader *image = dict_image_map(a, dicts, ndicts, key);
+	if (image && image->source_hash == source_hash)
+		dict_image = image;
+	else
+		dict_image_publish(a, dicts, ndicts, key, source_hash, image);
+	trace_end(zone);
+}
+
+static DictImageEntry *
+find_image_ent(DictImageHeader *image, s8 term, u64 h, i32 i)
+{
+	u8  *base  = (u8 *)image;
+	u64 *slots = (u64 *)(base + image->slots);
+	stats.find_calls++;
+	for (u32 probes = 1;; probes++) {
+		if (!slots[i]) {
+			stats_count_probes(stats.find_probes, probes);
+			return 0;
+		}
+
+		/* NOTE: a damaged entry ends the lookup as does a table without a
+		 * free slot once every slot was probed */
+		DictImageEntry *e = image_entry(image, slots[i]);
+		if (!e || s8_equal(image_s8(base, e->term), term)) {
+			stats_count_probes(stats.find_probes, probes);
+			return e;
+		}
+		if (probes >> image->ht_exp)
+			return 0;
+		stats.find_collisions++;
+		i = ht_lookup(h, image->ht_exp, i);
+	}
+}
+
+/* NOTE: looks up a group of at most LOOKUP_GROUP terms; see find_ents() */
+static void
+find_image_ents(DictImageHeader *image, s8 *terms, u32 n, DictImageEntry **ents)
+{
+	u8  *base  = (u8 *)image;
+	u64 *slots = (u64 *)(base + image->slots);
+	u64 h[LOOKUP_GROUP];
+	i32 slot[LOOKUP_GROUP];
+
+	for (u32 i = 0; i < n; i++) {
+		h[i]    = hash(terms[i]);
+		slot[i] = ht_lookup(h[i], image->ht_exp, h[i]);
+		__builtin_prefetch(slots + slot[i]);
+	}
+	for (u32 i = 0; i < n; i++)
+		if (slots[slot[i]]) __builtin_prefetch(base + slots[slot[i]]);
+	for (u32 i = 0; i < n; i++) {
+		if (slots[slot[i]] && slots[slot[i]] < image->size - sizeof(DictImageEntry)) {
+			DictImageEntry *e = (DictImageEntry *)(base + slots[slot[i]]);
+			__builtin_prefetch(base + e->term.offset);
+		}
+	}
+	for (u32 i = 0; i < n; i++)
+		ents[i] = find_image_ent(image, terms[i], h[i], slot[i]);
+}
+
+/* NOTE: the list is decoded into the arena with text pointing into the image */
+static DictDef *
+image_defs(Arena *a, DictImageHeader *image, DictImageEntry *e, u32 list)
+{
+	DictImageDefs defs = image_entry_defs(e, image->ndicts);
+	DictDef *result = 0;
+	for (u64 j = e->defs[list + 1]; j > e->defs[list]; j--) {
+		DictDef *def = alloc(a, DictDef, 1, ARENA_NO_CLEAR);
+		def->text    = image_s8((u8 *)image, defs.text[j - 1]);
+		def->bank    = defs.banks[j - 1];
+		def->score   = defs.scores[j - 1];
+		def->tags    = defs.tags[j - 1];
+		def->next    = result;
+		result       = def;
+	}
+	return result;
+}
+
+static DictEnt *
+find_ent(struct ht *t, s8 term, u64 h, i32 i)
+{
+	stats.find_calls++;
+	for (u32 probes = 1;; probes++) {
+		DictEnt *result = t->ents[i];
+		if (!result || s8_equal(result->term, term)) {
+			stats_count_probes(stats.find_probes, probes);
+			return result;
+		}
+		stats.find_collisions++;
+		i = ht_lookup(h, t->exp, i);
+	}
+}
+
+/* NOTE: the lookups of a group are interleaved so that their cache misses
+ * overlap: every term is hashed and its first slot prefetched, then each
+ * occupied slot's entry and then the entry's term. by the time the terms are
+ * compared most probes end on the first slot with everything in cache */
+static void
+find_ents(struct ht *t, s8 *terms, u32 n, DictEnt **ents)
+{
+	u64 h[LOOKUP_GROUP];
+	i32 slot[LOOKUP_GROUP];
+
+	for (u32 i = 0; i < n; i++) {
+		h[i]    = hash(terms[i]);
+		slot[i] = ht_lookup(h[i], t->exp, h[i]);
+		__builtin_prefetch(t->ents + slot[i]);
+	}
+	for (u32 i = 0; i < n; i++)
+		if (t->ents[slot[i]]) __builtin_prefetch(t->ents[slot[i]]);
+	for (u32 i = 0; i < n; i++)
+		if (t->ents[slot[i]]) __builtin_prefetch(t->ents[slot[i]]->term.s);
+	for (u32 i = 0; i < n; i++)
+		ents[i] = find_ent(t, terms[i], h[i], slot[i]);
+}
+
+/* fills defs with the definitions of each term in d and, when set, headwords
+ * with the spelling it has in the dictionary (the term itself if not found) */
+static void
+find_defs(Arena *a, Dict *d, s8 *terms, u32 nterms, DictDef **defs, s8 *headwords)
+{
+	for (u32 base = 0; base < nterms; base += LOOKUP_GROUP) {
+		u32 n = MIN(LOOKUP_GROUP, nterms - base);
+		if (dict_image) {
+			DictImageEntry *e[LOOKUP_GROUP];
+			find_image_ents(dict_image, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				defs[base + i] = e[i] ? image_defs(a, dict_image, e[i], dict_index(d)) : 0;
+				if (headwords)
+					headwords[base + i] = e[i] ? image_s8((u8 *)dict_image, e[i]->headword)
+					                           : terms[base + i];
+			}
+		} else {
+			struct ht *t = merged_index.ents ? &merged_index : &d->ht;
+			u32 list     = merged_index.ents ? dict_index(d) : 0;
+			DictEnt *e[LOOKUP_GROUP];
+			find_ents(t, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				if (e[i]) e[i]->defs[list] = rank_defs(e[i]->defs[list]);
+				defs[base + i] = e[i] ? e[i]->defs[list] : 0;
+				if (headwords)
+					headwords[base + i] = e[i] ? ent_headword(e[i]) : terms[base + i];
+			}
+		}
+	}
+}
+
+/* fills lists (nlists per term) with the definitions of each term in every
+ * configured dict using a single lookup per term */
+static void
+find_merged_defs(Arena *a, s8 *terms, u32 nterms, DictDef **lists, s8 *headwords)
+{
+	u32 nlists = ARRAY_COUNT(default_dict_map);
+	for (u32 base = 0; base < nterms; base += LOOKUP_GROUP) {
+		u32 n = MIN(LOOKUP_GROUP, nterms - base);
+		if (dict_image) {
+			DictImageEntry *e[LOOKUP_GROUP];
+			find_image_ents(dict_image, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				for (u32 j = 0; e[i] && j < dict_image->ndicts; j++)
+					lists[(base + i) * nlists + j] = image_defs(a, dict_image, e[i], j);
+				if (headwords)
+					headwords[base + i] = e[i] ? image_s8((u8 *)dict_image, e[i]->headword)
+					                           : terms[base + i];
+			}
+		} else {
+			DictEnt *e[LOOKUP_GROUP];
+			find_ents(&merged_index, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				for (u32 j = 0; e[i] && j < merged_index.nlists; j++) {
+					e[i]->defs[j] = rank_defs(e[i]->defs[j]);
+					lists[(base + i) * nlists + j] = e[i]->defs[j];
+				}
+				if (headwords)
+					headwords[base + i] = e[i] ? ent_headword(e[i]) : terms[base + i];
+			}
+		}
+	}
+}
+
+/* fills freqs with the lowest frequency rank of each term in any of dicts
+ * or 0 when none has one; image and merged tables hold it across every
+ * configured dict */
+static void
+find_freqs(Dict *dicts, u32 ndicts, s8 *terms, u32 nterms, u32 *freqs)
+{
+	for (u32 base = 0; base < nterms; base += LOOKUP_GROUP) {
+		u32 n = MIN(LOOKUP_GROUP, nterms - base);
+		for (u32 i = 0; i < n; i++)
+			freqs[base + i] = 0;
+		if (dict_image) {
+			DictImageEntry *e[LOOKUP_GROUP];
+			find_image_ents(dict_image, terms + base, n, e);
+			for (u32 i = 0; i < n; i++)
+				if (e[i]) freqs[base + i] = e[i]->freq;
+			continue;
+		}
+		for (u32 d = 0; d < (merged_index.ents ? 1 : ndicts); d++) {
+			DictEnt *e[LOOKUP_GROUP];
+			find_ents(merged_index.ents ? &merged_index : &dicts[d].ht, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				u32 freq = e[i] ? e[i]->freq : 0;
+				if (freq && (!freqs[base + i] || freq < freqs[base + i]))
+					freqs[base + i] = freq;
+			}
+		}
+	}
+}
+
+#define SCORE_NONE ((i32)0x80000000)
+
+/* fills scores with the highest score of any definition of each term in
+ * dicts or SCORE_NONE when none of them defines it; lists are in score order
+ * so only their first definition is read */
+static void
+find_scores(Dict *dicts, u32 ndicts, s8 *terms, u32 nterms, i32 *scores)
+{
+	for (u32 base = 0; base < nterms; base += LOOKUP_GROUP) {
+		u32 n = MIN(LOOKUP_GROUP, nterms - base);
+		for (u32 i = 0; i < n; i++)
+			scores[base + i] = SCORE_NONE;
+		if (dict_image) {
+			DictImageEntry *e[LOOKUP_GROUP];
+			find_image_ents(dict_image, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				if (!e[i])
+					continue;
+				u64 *ranges     = e[i]->defs;
+				i32 *def_scores = image_entry_defs(e[i], dict_image->ndicts).scores;
+				for (u32 d = 0; d < ndicts; d++) {
+					u32 list = dict_index(dicts + d);
+					if (ranges[list] < ranges[list + 1] && def_scores[ranges[list]] > scores[base + i])
+						scores[base + i] = def_scores[ranges[list]];
+				}
+			}
+			continue;
+		}
+		for (u32 d = 0; d < (merged_index.ents ? 1 : ndicts); d++) {
+			DictEnt *e[LOOKUP_GROUP];
+			find_ents(merged_index.ents ? &merged_index : &dicts[d].ht, terms + base, n, e);
+			for (u32 i = 0; i < n; i++) {
+				for (u32 j = 0; e[i] && j < (merged_index.ents ? ndicts : 1); j++) {
+					u32 list = merged_index.ents ? dict_index(dicts + j) : 0;
+					e[i]->defs[list] = rank_defs(e[i]->defs[list]);
+					DictDef *best    = e[i]->defs[list];
+					if (best && best->score > scores[base + i])
+						scores[base + i] = best->score;
+				}
+			}
+		}
+	}
+}
+
+static u32
+reverse_bucket_size(ReverseIndex *ri, u32 bucket)
+{
+	return ri->offsets[bucket + 1] - ri->offsets[bucket];
+}
+
+/* NOTE: the buckets of an image are only checked when used; a bucket must lie
+ * in the postings and end on the last byte of a varint */
+static b32
+reverse_bucket_valid(ReverseIndex *ri, u32 bucket)
+{
+	u32 beg = ri->offsets[bucket], end = ri->offsets[bucket + 1];
+	return beg <= end && end <= ri->offsets[1u << ri->exp] &&
+	       (beg == end || !(ri->postings[end - 1] & 0x80));
+}
+
+static u32
+varint_next(u8 **p)
+{
+	u32 result = 0;
+	for (u32 shift = 0;; shift += 7) {
+		result |= (u32)(**p & 0x7F) << shift;
+		if (!(*(*p)++ & 0x80)) break;
+	}
+	return result;
+}
+
+/* NOTE: an image carries the index of all of its dicts; otherwise it is built
+ * from the tables the term index was made from */
+static void
+make_reverse_index(Arena *a, Dict *dicts, u32 ndicts)
+{
+	ReverseIndex *ri = &reverse_index;
+	if (ri->offsets)
+		return;
+	if (dict_image) {
+		*ri = image_reverse_index(dict_image);
+		return;
+	}
+
+	struct ht *tables[ARRAY_COUNT(default_dict_map)];
+	u32 ntables = 0;
+	if (merged_index.ents) {
+		tables[ntables++] = &merged_index;
+	} else {
+		for (u32 i = 0; i < ndicts; i++)
+			tables[ntables++] = &dicts[i].ht;
+	}
+	reverse_index_build(a, ri, tables, ntables);
+}
+
+static b32
+s8_contains(s8 haystack, s8 needle)
+{
+	for (size i = 0; i + needle.len <= haystack.len; i++) {
+		if (haystack.s[i] == needle.s[0] &&
+		    s8_equal((s8){.len = needle.len, .s = haystack.s + i}, needle))
+			return 1;
+	}
+	return 0;
+}
+
+/* returns the distinct terms whose definitions in dicts contain query in
+ * lexicographic order. the postings of every key of the query are intersected
+ * starting from the shortest and the remaining terms are then checked for the
+ * whole query since keys can match out of order */
+static s8 *
+expand_reverse(Arena *a, Dict *dicts, u32 ndicts, s8 query, i32 *count)
+{
+	ReverseIndex *ri = &reverse_index;
+	Arena tmp = *a;
+
+	*count = 0;
+	s8 folded   = s8trim(reverse_fold(&tmp, query));
+	u64 *keys   = alloc(&tmp, u64, folded.len + 1, ARENA_NO_CLEAR);
+	size nkeys  = reverse_keys(folded, keys, 1);
+	if (!nkeys) {
+		arena_rewind(&tmp, *a);
+		return 0;
+	}
+
+	u32 *buckets  = alloc(&tmp, u32, nkeys, ARENA_NO_CLEAR);
+	size shortest = 0;
+	for (size i = 0; i < nkeys; i++) {
+		buckets[i] = reverse_bucket(ri, keys[i]);
+		if (!reverse_bucket_valid(ri, buckets[i]) || reverse_bucket_size(ri, buckets[i]) == 0) {
+			arena_rewind(&tmp, *a);
+			return 0;
+		}
+		if (reverse_bucket_size(ri, buckets[i]) < reverse_bucket_size(ri, buckets[shortest]))
+			shortest = i;
+	}
+
+	/* NOTE: every posting takes at least one byte; ids outside of the term
+	 * index can only come from a damaged image */
+	u8  *in    = ri->postings + ri->offsets[buckets[shortest]];
+	u8  *end   = ri->postings + ri->offsets[buckets[shortest] + 1];
+	u32 *cands = alloc(&tmp, u32, end - in, ARENA_NO_CLEAR);
+	u32 ncands = 0;
+	for (u32 id = 0; in < end;) {
+		id += varint_next(&in);
+		if (id - 1 < (u32)term_index.nterms)
+			cands[ncands++] = id;
+	}
+
+	for (size k = 0; k < nkeys && ncands; k++) {
+		if (buckets[k] == buckets[shortest])
+			continue;
+		u8 *p   = ri->postings + ri->offsets[buckets[k]];
+		u8 *end = ri->postings + ri->offsets[buckets[k] + 1];
+		u32 id = 0, kept = 0;
+		for (u32 i = 0; i < ncands;) {
+			if (id < cands[i]) {
+				if (p == end) break;
+				id += varint_next(&p);
+			} else if (id > cands[i]) {
+				i++;
+			} else {
+				cands[kept++] = cands[i++];
+			}
+		}
+		ncands = kept;
+	}
+
+	s8 *terms = alloc(&tmp, s8, ncands, ARENA_NO_CLEAR);
+	for (u32 i = 0; i < ncands; i++)
+		terms[i] = term_index_term(&term_index, cands[i] - 1);
+
+	i32 nmarked = 0;
+	DictDef **defs = alloc(&tmp, DictDef *, ncands, ARENA_NO_CLEAR);
+	for (u32 d = 0; d < ndicts; d++) {
+		find_defs(&tmp, dicts + d, terms, ncands, defs, 0);
+		for (u32 i = 0; i < ncands; i++) {
+			u32 id = cands[i] - 1;
+			for (DictDef *def = defs[i]; def && !term_index.marks[id]; def = def->next) {
+				Arena scratch = tmp;
+				if (s8_contains(reverse_fold(&scratch, def->text), folded)) {
+					term_index.marks[id] = 1;
+					nmarked++;
+				}
+				arena_rewind(&scratch, tmp);
+			}
+		}
+	}
+
+	arena_rewind(&tmp, *a);
+	return term_index_take_marked(a, nmarked, count);
+}
+
+/* NOTE: moves the k smallest of the n distinct values in v to its front
+ * (Hoare's FIND); the rest is left unordered */
+static void
+select_smallest(u64 *v, i32 n, i32 k)
+{
+	i32 lo = 0, hi = n - 1;
+	while (lo < hi) {
+		u64 pivot = v[lo + (hi - lo) / 2];
+		i32 i = lo, j = hi;
+		while (i <= j) {
+			while (v[i] < pivot) i++;
+			while (v[j] > pivot) j--;
+			if (i <= j) {
+				u64 t  = v[i];
+				v[i++] = v[j];
+				v[j--] = t;
+			}
+		}
+		if      (k - 1 <= j) hi = j;
+		else if (k - 1 >= i) lo = i;
+		else                 break;
+	}
+}
+
+/* NOTE: bottom up merge sort through tmp which must hold n values */
+static void
+sort_u64(u64 *v, i32 n, u64 *tmp)
+{
+	for (i32 w = 1; w < n; w *= 2) {
+		for (i32 lo = 0; lo < n; lo += 2 * w) {
+			i32 mid = MIN(lo + w, n), hi = MIN(lo + 2 * w, n);
+			i32 i = lo, j = mid, k = lo;
+			while (i < mid && j < hi) tmp[k++] = v[i] <= v[j] ? v[i++] : v[j++];
+			while (i < mid)           tmp[k++] = v[i++];
+			while (j < hi)            tmp[k++] = v[j++];
+		}
+		for (i32 i = 0; i < n; i++)
+			v[i] = tmp[i];
+	}
+}
+
+/* NOTE: keeps the k most frequent of terms in order of frequency; terms
+ * without a frequency come last and ties keep their order. only the kept
+ * terms are sorted so ranking many matches for a small k stays linear */
+static i32
+rank_terms(Arena *a, Dict *dicts, u32 ndicts, s8 *terms, i32 nterms, i32 k)
+{
+	k = MIN(k, nterms);
+	if (k == 0)
+		return 0;
+
+	Arena tmp  = *a;
+	u32 *freqs = alloc(&tmp, u32, nterms, ARENA_NO_CLEAR);
+	u64 *keys  = alloc(&tmp, u64, nterms, ARENA_NO_CLEAR);
+	find_freqs(dicts, ndicts, terms, nterms, freqs);
+	for (i32 i = 0; i < nterms; i++)
+		keys[i] = (u64)(freqs[i] ? freqs[i] : (u32)-1) << 32 | (u32)i;
+
+	select_smallest(keys, nterms, k);
+	sort_u64(keys, k, alloc(&tmp, u64, k, ARENA_NO_CLEAR));
+
+	s8 *ranked = alloc(&tmp, s8, k, ARENA_NO_CLEAR);
+	for (i32 i = 0; i < k; i++)
+		ranked[i] = terms[(u32)keys[i]];
+	for (i32 i = 0; i < k; i++)
+		terms[i] = ranked[i];
+	arena_rewind(&tmp, *a);
+	return k;
+}
+
+/* NOTE: returns terms with every reverse query or wildcard term replaced by its
+ * matches; queries holds the query as typed of each term and is replaced by
+ * that of each match */
+static s8 *
+expand_terms(Arena *a, Dict *dicts, u32 ndicts, s8 *terms, i32 *nterms, s8 **queries, b32 reverse)
+{
+	s8 **parts  = alloc(a, s8 *, *nterms, ARENA_NO_CLEAR);
+	i32 *counts = alloc(a, i32,  *nterms, ARENA_NO_CLEAR);
+	i32 total   = 0;
+	for (i32 i = 0; i < *nterms; i++) {
+		if (reverse) {
+			parts[i] = expand_reverse(a, dicts, ndicts, terms[i], counts + i);
+		} else if (is_glob(terms[i])) {
+			parts[i] = expand_glob(a, terms[i], counts + i);
+		} else {
+			parts[i]  = terms + i;
+			counts[i] = 1;
+		}
+		if (print_limit && parts[i] != terms + i)
+			counts[i] = rank_terms(a, dicts, ndicts, parts[i], counts[i], print_limit);
+		total += counts[i];
+	}
+
+	s8 *typed  = *queries;
+	s8 *result = alloc(a, s8, total, ARENA_NO_CLEAR);
+	*queries   = alloc(a, s8, total, ARENA_NO_CLEAR);
+	for (i32 i = 0, j = 0; i < *nterms; i++) {
+		for (i32 k = 0; k < counts[i]; k++, j++) {
+			result[j]      = parts[i][k];
+			(*queries)[j] = typed[i];
+		}
+	}
+	*nterms = total;
+	return result;
+}
+
+static void
+print_defs_json(s8 query, s8 term, Dict *d, DictDef *defs)
+{
+	Stream *s = &stdout_stream;
+	u32 printed    = 0;
+	TagSet *filter = tag_filter.len ? dict_tag_filter(d) : 0;
+	TagSet *sets   = tag_filter.len ? dict_tag_sets(d)   : 0;
+	for (DictDef *def = defs; def && (!print_limit || printed < print_limit); def = def->next) {
+		if (filter && !tag_set_matches(def->tags, filter, sets))
+			continue;
+		s8 text = s8trim(def->text);
+		if (!text.len)
+			continue;
+		if (!printed++) {
+			stream_append_s8(s, s8("{\"query\":\""));
+			stream_append_json(s, query, 0);
+			stream_append_s8(s, s8("\",\"term\":\""));
+			stream_append_json(s, term, 0);
+			stream_append_s8(s, s8("\",\"rom\":\""));
+			stream_append_json(s, d->rom, 0);
+			stream_append_s8(s, s8("\",\"name\":\""));
+			stream_append_json(s, d->name, 0);
+			stream_append_s8(s, s8("\",\"definitions\":[\""));
+		} else {
+			stream_append_s8(s, s8("\",\""));
+		}
+		stream_append_json(s, text, json_is_string_body(text));
+	}
+	if (printed)
+		stream_append_s8(s, s8("\"]}\n"));
+}
+
+static void
+print_defs(s8 query, s8 term, Dict *d, DictDef *defs)
+{
+	if (!defs)
+		return;
+
+	TraceZone zone = trace_begin(s8("find_and_print"), term);
+	if (print_json) {
+		print_defs_json(query, term, d, defs);
+		trace_end(zone);
+		return;
+	}
+
+	b32 print_for_readability = s8_equal(fsep, s8("\n"));
+	b32 printed_header        = 0;
+	u32 printed               = 0;
+	TagSet *filter            = tag_filter.len ? dict_tag_filter(d) : 0;
+	TagSet *sets              = tag_filter.len ? dict_tag_sets(d)   : 0;
+	for (DictDef *def = defs; def && (!print_limit || printed < print_limit); def = def->next) {
+		/* NOTE: tested before the text is touched */
+		if (filter && !tag_set_matches(def->tags, filter, sets))
+			continue;
+		/* NOTE: some dictionaries are "hand-made" by idiots and have definitions
+		 * with only white space in them */
+		s8 text = print_for_readability ? s8trim_escaped(def->text) : s8trim(def->text);
+		if (text.len) {
+			if (!print_for_readability) {
+				stream_append_s8(&stdout_stream, d->name);
+				if (print_terms) {
+					stream_append_s8(&stdout_stream, fsep);
+					stream_append_s8(&stdout_stream, term);
+				}
+			} else if (!printed_header) {
+				stream_append_s8(&stdout_stream, s8("\x1b[36;1m"));
+				stream_append_s8(&stdout_stream, d->name);
+				stream_append_s8(&stdout_stream, s8("\x1b[0m"));
+				if (print_terms) {
+					stream_append_byte(&stdout_stream, ' ');
+					stream_append_s8(&stdout_stream, term);
+				}
+				printed_header = 1;
+			}
+
+			stream_append_s8(&stdout_stream, fsep);
+			if (print_for_readability) stream_append_unescaped(&stdout_stream, text);
+			else                       stream_append_ref(&stdout_stream, text);
+			stream_append_byte(&stdout_stream, '\n');
+			printed++;
+		}
+	}
+	if (print_for_readability && printed_header)
+		stream_append_byte(&stdout_stream, '\n');
+	trace_end(zone);
+}
+
+static void
+find_and_print(Arena *a, s8 query, s8 term, Dict *d)
+{
+	Arena tmp = *a;
+	DictDef *defs;
+	s8 headword;
+	find_defs(&tmp, d, &term, 1, &defs, &headword);
+	print_defs(query, headword, d, defs);
+	arena_rewind(&tmp, *a);
+}
+
+static void
+find_and_print_defs(Arena *a, Dict *dict, s8 *queries, s8 *terms, u32 nterms)
+{
+	if (!make_dict(a, dict)) {
+		stream_append_s8(&error_stream, s8("failed to allocate dict: "));
+		stream_append_s8(&error_stream, dict->rom);
+		stream_append_byte(&stdout_stream, '\n');
+		return;
+	}
+
+	Arena tmp = *a;
+	DictDef **defs = alloc(&tmp, DictDef *, nterms, ARENA_NO_CLEAR);
+	s8 *headwords  = alloc(&tmp, s8, nterms, ARENA_NO_CLEAR);
+	find_defs(&tmp, dict, terms, nterms, defs, headwords);
+	for (u32 i = 0; i < nterms; i++)
+		print_defs(queries[i], headwords[i], dict, defs[i]);
+	arena_rewind(&tmp, *a);
+}
+
+/* NOTE: every term is looked up once before anything is printed so that the
+ * output is grouped by dict in the same way as find_and_print_defs */
+static void
+find_and_print_merged(Arena *a, Dict *dicts, u32 ndicts, s8 *queries, s8 *terms, u32 nterms)
+{
+	Arena tmp  = *a;
+	u32 nlists = ARRAY_COUNT(default_dict_map);
+	DictDef **lists = alloc(&tmp, DictDef *, nterms * nlists, 0);
+	s8 *headwords   = alloc(&tmp, s8, nterms, ARENA_NO_CLEAR);
+	find_merged_defs(&tmp, terms, nterms, lists, headwords);
+
+	for (u32 i = 0; i < ndicts; i++) {
+		u32 list = dict_index(dicts + i);
+		for (u32 j = 0; j < nterms; j++)
+			print_defs(queries[j], headwords[j], dicts + i, lists[j * nlists + list]);
+	}
+	arena_rewind(&tmp, *a);
+}
+
+/* NOTE: every word costs SEGMENT_WORD_COST so fewer, longer words win; a per
+ * character cost would be the same for every segmentation of a sentence so
+ * term length only enters through the number of words. the score of the
+ * best definition (clamped to SEGMENT_SCORE_MAX) is taken off the cost of a
+ * word and every character no term covers costs SEGMENT_UNKNOWN_COST */
+#define SEGMENT_WORD_COST    1000
+#define SEGMENT_SCORE_MAX    100
+#define SEGMENT_UNKNOWN_COST 100000
+
+/* NOTE: FNV-1a in text order so that the hash of a prefix extends to that of
+ * the next longer prefix one character at a time */
+#define SEGMENT_HASH_SEED        0x3243f6a8885a308dULL
+#define SEGMENT_HASH_STEP(h, c)  (((h) ^ (c)) * 1111111111111111111ULL)
+#define SEGMENT_PREFIX_BIT(h, e) ((h) >> (64 - (e)))
+#define SEGMENT_TERM_BIT(h, e)   (((h) * 0x9E3779B97F4A7C15ULL) >> (64 - (e)))
+
+static void
+segment_filter_set(Segmenter *sg, u64 bit)
+{
+	sg->filter[bit >> 6] |= 1ULL << (bit & 63);
+}
+
+static b32
+segment_filter_test(Segmenter *sg, u64 bit)
+{
+	return (sg->filter[bit >> 6] >> (bit & 63)) & 1;
+}
+
+static void
+segment_filter_push(Segmenter *sg, s8 term)
+{
+	u64 h     = SEGMENT_HASH_SEED;
+	u32 chars = 0;
+	for (size i = 0; i < term.len; i++) {
+		h = SEGMENT_HASH_STEP(h, term.s[i]);
+		if (i + 1 < term.len && (term.s[i + 1] & 0xC0) == 0x80)
+			continue;
+		if (++chars > SEGMENT_MAX_CHARS)
+			return;
+		segment_filter_set(sg, SEGMENT_PREFIX_BIT(h, sg->filter_exp));
+	}
+	segment_filter_set(sg, SEGMENT_TERM_BIT(h, sg->filter_exp));
+}
+
+static void
+segment_filter_push_table(Segmenter *sg, struct ht *t)
+{
+	for (u64 i = 0; i < (u64)1 << t->exp; i++)
+		if (t->ents[i]) segment_filter_push(sg, t->ents[i]->term);
+}
+
+/* NOTE: the tables must already be built; the filter has 64 bits per term so
+ * about one in ten rejected candidates gets through */
+static void
+make_segmenter(Arena *a, Dict *dicts, u32 ndicts)
+{
+	Segmenter *sg = &segmenter;
+	if (sg->filter)
+		return;
+
+	TraceZone zone = trace_begin(s8("make_segmenter"), s8(""));
+	u64 nterms = 0;
+	if      (dict_image)        nterms = dict_image->ht_len;
+	else if (merged_index.ents) nterms = merged_index.len;
+	else for (u32 i = 0; i < ndicts; i++) nterms += dicts[i].ht.len;
+
+	for (sg->filter_exp = 16; ((u64)1 << sg->filter_exp) < 64 * nterms; sg->filter_exp++);
+	sg->filter = alloc(a, u64, (size)1 << (sg->filter_exp - 6), 0);
+
+	if (dict_image) {
+		u8  *base  = (u8 *)dict_image;
+		u64 *slots = (u64 *)(base + dict_image->slots);
+		for (u64 i = 0; i < (u64)1 << dict_image->ht_exp; i++) {
+			DictImageEntry *e = slots[i] ? image_entry(dict_image, slots[i]) : 0;
+			if (e)
+				segment_filter_push(sg, image_s8(base, e->term));
+		}
+	} else if (merged_index.ents) {
+		segment_filter_push_table(sg, &merged_index);
+	} else {
+		for (u32 i = 0; i < ndicts; i++)
+			segment_filter_push_table(sg, &dicts[i].ht);
+	}
+	trace_end(zone);
+}
+
+/* NOTE: looks up the terms of the collected edges and relaxes them in order
+ * of their start; the cost of a start is final by then since every edge
+ * ending there starts earlier */
+static void
+segment_relax(Segmenter *sg, Dict *dicts, u32 ndicts, s8 text, u32 nedges)
+{
+	s8  terms[ARRAY_COUNT(sg->edges)];
+	i32 scores[ARRAY_COUNT(sg->edges)];
+	u32 nterms = 0;
+	for (u32 i = 0; i < nedges; i++) {
+		SegmentEdge *e = sg->edges + i;
+		if (e->known)
+			terms[nterms++] = (s8){.len = e->end - e->start, .s = text.s + e->start};
+	}
+	find_scores(dicts, ndicts, terms, nterms, scores);
+
+	for (u32 i = 0, k = 0; i < nedges; i++) {
+		SegmentEdge *e = sg->edges + i;
+		i64 cost = SEGMENT_UNKNOWN_COST;
+		if (e->known) {
+			/* NOTE: filter false positives and terms only other dicts define */
+			i32 score = scores[k++];
+			if (score == SCORE_NONE)
+				continue;
+			if (score >  SEGMENT_SCORE_MAX) score =  SEGMENT_SCORE_MAX;
+			if (score < -SEGMENT_SCORE_MAX) score = -SEGMENT_SCORE_MAX;
+			cost = SEGMENT_WORD_COST - score;
+		}
+		cost += sg->cost[e->start];
+		if (cost < sg->cost[e->end]) {
+			sg->cost[e->end]  = cost;
+			sg->back[e->end]  = e->start;
+			sg->known[e->end] = e->known;
+		}
+	}
+}
+
+/* NOTE: Viterbi over the lattice of every term starting at each character of
+ * the normalized sentence. runs of characters no term covers are a single
+ * segment */
+static u32
+segment(Arena *a, Segmenter *sg, Dict *dicts, u32 ndicts, s8 sentence)
+{
+	if (NORMALIZE_MAX_LEN(sentence.len) + 1 > sg->cap) {
+		sg->cap      = MIN((size)0x7FFFFFFF, 2 * (NORMALIZE_MAX_LEN(sentence.len) + 1) + 4096);
+		sg->cost     = alloc(a, i64, sg->cap, ARENA_NO_CLEAR);
+		sg->back     = alloc(a, i32, sg->cap, ARENA_NO_CLEAR);
+		sg->known    = alloc(a, u8,  sg->cap, ARENA_NO_CLEAR);
+		sg->text     = alloc(a, u8,  sg->cap, ARENA_NO_CLEAR);
+		sg->offsets  = alloc(a, i32, sg->cap, ARENA_NO_CLEAR);
+		sg->segments = alloc(a, s8,  sg->cap, ARENA_NO_CLEAR);
+		sg->terms    = alloc(a, s8,  sg->cap, ARENA_NO_CLEAR);
+	}
+	s8 text = {.s = sg->text};
+	text.len = normalize_utf8(text.s, sentence.s, sentence.len, sg->offsets);
+	sg->offsets[text.len] = sentence.len;
+
+	i32 n = text.len;
+	sg->cost[0] = 0;
+	for (i32 i = 1; i <= n; i++)
+		sg->cost[i] = (i64)((u64)-1 >> 1);
+
+	u32 nedges = 0;
+	for (i32 i = 0; i < n;) {
+		i32 next = i + 1;
+		for (; next < n && (text.s[next] & 0xC0) == 0x80; next++);
+		sg->edges[nedges++] = (SegmentEdge){.start = i, .end = next};
+
+		u64 h = SEGMENT_HASH_SEED;
+		for (i32 j = i, chars = 0; j < n && chars < SEGMENT_MAX_CHARS; chars++) {
+			do h = SEGMENT_HASH_STEP(h, text.s[j]); while (++j < n && (text.s[j] & 0xC0) == 0x80);
+			if (!segment_filter_test(sg, SEGMENT_PREFIX_BIT(h, sg->filter_exp)))
+				break;
+			if (segment_filter_test(sg, SEGMENT_TERM_BIT(h, sg->filter_exp)))
+				sg->edges[nedges++] = (SegmentEdge){.start = i, .end = j, .known = 1};
+		}
+
+		i = next;
+		if (nedges >= SEGMENT_BATCH || i == n) {
+			segment_relax(sg, dicts, ndicts, text, nedges);
+			nedges = 0;
+		}
+	}
+
+	u32 nsegments = 0;
+	for (i32 end = n; end > 0;) {
+		i32 start = sg->back[end];
+		if (!sg->known[end])
+			while (start > 0 && !sg->known[start]) start = sg->back[start];
+		i32 first = sg->offsets[start], last = sg->offsets[end];
+		sg->segments[nsegments] = (s8){.len = last - first, .s = sentence.s + first};
+		sg->terms[nsegments++]  = (s8){.len = end - start,  .s = text.s + start};
+		end = start;
+	}
+	for (u32 i = 0; i < nsegments / 2; i++) {
+		s8 tmp = sg->segments[i];
+		sg->segments[i] = sg->segments[nsegments - i - 1];
+		sg->segments[nsegments - i - 1] = tmp;
+		tmp = sg->terms[i];
+		sg->terms[i] = sg->terms[nsegments - i - 1];
+		sg->terms[nsegments - i - 1] = tmp;
+	}
+	return nsegments;
+}
+
+/* NOTE: the segmentation is printed on a line of its own (an object with the
+ * segments in JSON mode) followed by the definitions of each segment in
+ * sentence order. scratch grows only for the longest sentence so far; the
+ * definitions are decoded into a copy of it which is dropped afterwards */
+static void
+segment_and_print(Arena *scratch, Dict *dicts, u32 ndicts, b32 merged, s8 sentence)
+{
+	Segmenter *sg = &segmenter;
+	TraceZone zone = trace_begin(s8("segment"), sentence);
+	u32 nsegments  = segment(scratch, sg, dicts, ndicts, sentence);
+	trace_end(zone);
+
+	Stream *s = &stdout_stream;
+	if (print_json) {
+		stream_append_s8(s, s8("{\"query\":\""));
+		stream_append_json(s, sentence, 0);
+		stream_append_s8(s, s8("\",\"segments\":["));
+		for (u32 i = 0; i < nsegments; i++) {
+			stream_append_s8(s, i ? s8(",\"") : s8("\""));
+			stream_append_json(s, sg->segments[i], 0);
+			stream_append_byte(s, '"');
+		}
+		stream_append_s8(s, s8("]}\n"));
+	} else {
+		for (u32 i = 0; i < nsegments; i++) {
+			if (i) stream_append_byte(s, ' ');
+			stream_append_s8(s, sg->segments[i]);
+		}
+		stream_append_s8(s, s8_equal(fsep, s8("\n")) ? s8("\n\n") : s8("\n"));
+	}
+
+	Arena tmp    = *scratch;
+	u32   nlists = merged ? ARRAY_COUNT(default_dict_map) : ndicts;
+	DictDef **defs = alloc(&tmp, DictDef *, nsegments * nlists, 0);
+	s8 *headwords  = alloc(&tmp, s8, nsegments * ndicts, ARENA_NO_CLEAR);
+	if (merged) {
+		find_merged_defs(&tmp, sg->terms, nsegments, defs, headwords);
+	} else {
+		for (u32 i = 0; i < ndicts; i++)
+			find_defs(&tmp, dicts + i, sg->terms, nsegments, defs + i * nsegments,
+			          headwords + i * nsegments);
+	}
+
+	b32 old_print_terms = print_terms;
+	print_terms = 1;
+	for (u32 i = 0; i < nsegments; i++) {
+		for (u32 j = 0; j < ndicts; j++) {
+			DictDef *list = merged ? defs[i * nlists + dict_index(dicts + j)]
+			                       : defs[j * nsegments + i];
+			s8 headword   = merged ? headwords[i] : headwords[j * nsegments + i];
+			print_defs(sentence, headword, dicts + j, list);
 		}
 	}
+	print_terms = old_print_terms;
+	arena_rewind(&tmp, *scratch);
+}
 
-	for (i32 i = 0; i < r; i++) {
-		YomiTok *base_tok = toks + i;
-		if (base_tok->type != YOMI_ENTRY)
-			continue;
+static void
+print_kanji_json(s8 query, KanjiEnt *e)
+{
+	Stream *s = &stdout_stream;
+	Dict   *d = default_dict_map + e->dict;
+	stream_append_s8(s, s8("{\"query\":\""));
+	stream_append_json(s, query, 0);
+	stream_append_s8(s, s8("\",\"kanji\":\""));
+	stream_append_json(s, e->kanji, 1);
+	stream_append_s8(s, s8("\",\"rom\":\""));
+	stream_append_json(s, d->rom, 0);
+	stream_append_s8(s, s8("\",\"name\":\""));
+	stream_append_json(s, d->name, 0);
+	stream_append_s8(s, s8("\",\"onyomi\":\""));
+	stream_append_json(s, e->onyomi, 1);
+	stream_append_s8(s, s8("\",\"kunyomi\":\""));
+	stream_append_json(s, e->kunyomi, 1);
+	stream_append_s8(s, s8("\",\"tags\":\""));
+	stream_append_json(s, e->tags, 1);
+	stream_append_s8(s, s8("\",\"strokes\":"));
+	stream_append_u64(s, e->strokes);
+	stream_append_s8(s, s8(",\"meanings\":["));
+	for (u32 i = 0; i < e->nmeanings; i++) {
+		stream_append_s8(s, i ? s8(",\"") : s8("\""));
+		stream_append_json(s, e->meanings[i], 1);
+		stream_append_byte(s, '"');
+	}
+	stream_append_s8(s, s8("]}\n"));
+}
 
-		YomiTok *tstr = 0, *tdefs = 0;
-		for (usize j = 1; j < base_tok->len; j++) {
-			switch (base_tok[j].type) {
-			case YOMI_STR:   if (!tstr)  tstr  = base_tok + j; break;
-			case YOMI_ARRAY: if (!tdefs) tdefs = base_tok + j; break;
-			default: break;
+static void
+print_kanji(s8 query, KanjiEnt *e)
+{
+	if (print_json) {
+		print_kanji_json(query, e);
+		return;
+	}
+
+	Stream *s = &stdout_stream;
+	Dict   *d = default_dict_map + e->dict;
+	s8 labels[] = {s8("音読み: "), s8("訓読み: "), s8("画数: "), s8("意味: ")};
+	b32 print_for_readability = s8_equal(fsep, s8("\n"));
+	if (print_for_readability) {
+		stream_append_s8(s, s8("\x1b[36;1m"));
+		stream_append_s8(s, d->name);
+		stream_append_s8(s, s8("\x1b[0m "));
+	} else {
+		stream_append_s8(s, d->name);
+		stream_append_s8(s, fsep);
+	}
+	stream_append_s8(s, e->kanji);
+
+	/* NOTE: empty fields are skipped when printing for readability and kept
+	 * otherwise so that every line has the same fields */
+	for (u32 field = 0; field < ARRAY_COUNT(labels); field++) {
+		b32 empty = (field == 0 && !e->onyomi.len) || (field == 1 && !e->kunyomi.len) ||
+		            (field == 2 && !e->strokes)    || (field == 3 && !e->nmeanings);
+		if (print_for_readability && empty)
+			continue;
+		stream_append_s8(s, fsep);
+		if (print_for_readability)
+			stream_append_s8(s, labels[field]);
+		switch (field) {
+		case 0: stream_append_unescaped(s, e->onyomi);  break;
+		case 1: stream_append_unescaped(s, e->kunyomi); break;
+		case 2: if (e->strokes) stream_append_u64(s, e->strokes); break;
+		case 3:
+			for (u32 i = 0; i < e->nmeanings; i++) {
+				if (i) stream_append_s8(s, s8(", "));
+				stream_append_unescaped(s, e->meanings[i]);
 			}
+			break;
 		}
+	}
+	stream_append_byte(s, '\n');
+	if (print_for_readability)
+		stream_append_byte(s, '\n');
+}
 
-		/* check if entry was valid */
-		if (!tdefs || !tstr) {
-			stream_append_s8(&error_stream, s8("parse_term_bank: invalid entry: missing "));
-			if (!tdefs) stream_append_s8(&error_stream, s8("definition token\n"));
-			else        stream_append_s8(&error_stream, s8("name token\n"));
-			break;
+/* NOTE: every character of the query costs two array loads; a kanji which
+ * occurs more than once is only printed the first time */
+static void
+find_and_print_kanji(s8 query, s8 term)
+{
+	static u32 queries;
+	queries++;
+
+	TraceZone zone = trace_begin(s8("find_and_print_kanji"), term);
+	for (s8 rest = term; rest.len;) {
+		KanjiEnt *e = kanji_lookup(&kanji_index, utf8_next(&rest));
+		if (!e || e->printed == queries)
+			continue;
+		for (;;) {
+			e->printed = queries;
+			print_kanji(query, e);
+			if (!e->next)
+				break;
+			e = kanji_index.ents + e->next - 1;
 		}
+	}
+	trace_end(zone);
+}
 
-		s8 mem_term = {.len = tstr->end - tstr->start, .s = data.s + tstr->start};
-		DictEnt **n = intern(ht, mem_term);
+static void
+stream_append_stat(Stream *s, s8 name, u64 value)
+{
+	stream_append_s8(s, name);
+	stream_append_byte(s, '\t');
+	stream_append_u64(s, value);
+	stream_append_byte(s, '\n');
+}
 
-		if (!*n) {
-			*n         = alloc(a, DictEnt, 1, 0);
-			(*n)->term = s8_dup(a, mem_term);
-		} else {
-			if (!s8_equal((*n)->term, mem_term)) {
-				stream_append_s8(&error_stream, s8("hash collision: "));
-				stream_append_s8(&error_stream, mem_term);
-				stream_append_byte(&error_stream, '\t');
-				stream_append_s8(&error_stream, (*n)->term);
-				stream_append_byte(&error_stream, '\n');
-			}
+static void
+stream_append_probe_histogram(Stream *s, s8 name, u64 *histogram)
+{
+	for (u32 i = 0; i < STATS_PROBE_BUCKETS; i++) {
+		if (!histogram[i])
+			continue;
+		stream_append_s8(s, name);
+		stream_append_byte(s, '[');
+		stream_append_u64(s, i + 1);
+		if (i == STATS_PROBE_BUCKETS - 1)
+			stream_append_byte(s, '+');
+		stream_append_s8(s, s8("]\t"));
+		stream_append_u64(s, histogram[i]);
+		stream_append_byte(s, '\n');
+	}
+}
+
+static void
+stream_append_table_fill(Stream *s, s8 name, u32 len, u32 exp)
+{
+	stream_append_s8(s, s8("table fill "));
+	stream_append_s8(s, name);
+	stream_append_byte(s, '\t');
+	stream_append_u64(s, len);
+	stream_append_byte(s, '/');
+	stream_append_u64(s, (u64)1 << exp);
+	stream_append_byte(s, '\n');
+}
+
+static void
+dump_stats(Stream *s, Dict *dicts, u32 ndicts)
+{
+	stream_append_stat(s, s8("tokens scanned"),    stats.tokens_scanned);
+	stream_append_stat(s, s8("entries interned"),  stats.entries_interned);
+	stream_append_stat(s, s8("intern collisions"), stats.intern_collisions);
+	stream_append_probe_histogram(s, s8("intern probes"), stats.intern_probes);
+	stream_append_stat(s, s8("table grows"),       stats.table_grows);
+	stream_append_stat(s, s8("lookups"),           stats.find_calls);
+	stream_append_stat(s, s8("lookup collisions"), stats.find_collisions);
+	stream_append_probe_histogram(s, s8("lookup probes"), stats.find_probes);
+	for (u32 i = 0; i < ndicts; i++) {
+		if (dicts[i].ht.ents)
+			stream_append_table_fill(s, dicts[i].rom, dicts[i].ht.len, dicts[i].ht.exp);
+	}
+	if (merged_index.ents)
+		stream_append_table_fill(s, s8("merged"), merged_index.len, merged_index.exp);
+	if (dict_image)
+		stream_append_table_fill(s, s8("image"), dict_image->ht_len, dict_image->ht_exp);
+	if (kanji_index.built)
+		stream_append_stat(s, s8("kanji entries"), kanji_index.len);
+	stream_append_stat(s, s8("bytes read"),        stats.bytes_read);
+	stream_append_stat(s, s8("bytes inflated"),    stats.bytes_inflated);
+	stream_append_stat(s, s8("syscalls"),          stats.syscalls);
+	stream_append_stat(s, s8("stream flushes"),    stats.stream_flushes);
+	stream_append_stat(s, s8("bytes gathered"),    stats.bytes_gathered);
+	stream_append_stat(s, s8("banks parsed"),      stats.banks_parsed);
+	stream_append_stat(s, s8("banks reused"),      stats.banks_reused);
+	if (stats.result_cache_hits + stats.result_cache_misses) {
+		u64 queries = stats.result_cache_hits + stats.result_cache_misses;
+		stream_append_stat(s, s8("result cache hits"),      stats.result_cache_hits);
+		stream_append_stat(s, s8("result cache misses"),    stats.result_cache_misses);
+		stream_append_stat(s, s8("result cache evictions"), stats.result_cache_evictions);
+		stream_append_s8(s, s8("result cache hit rate\t"));
+		stream_append_u64(s, stats.result_cache_hits * 100 / queries);
+		stream_append_s8(s, s8("%\n"));
+	}
+	stream_append_stat(s, s8("simd width"),        simd.width);
+	stream_append_stat(s, s8("arena peak"),        stats.arena_peak);
+	stream_append_stat(s, s8("arena capacity"),    stats.arena_capacity);
+}
+
+/* NOTE: reads stdin until EOF doubling the buffer as needed */
+static s8
+read_stdin(Arena *a)
+{
+	size cap  = 1 * MEGABYTE;
+	s8 result = {.s = alloc(a, u8, cap, ARENA_NO_CLEAR)};
+	for (;;) {
+		if (result.len == cap) {
+			u8 *data = alloc(a, u8, 2 * cap, ARENA_NO_CLEAR);
+			for (size i = 0; i < result.len; i++)
+				data[i] = result.s[i];
+			result.s = data;
+			cap     *= 2;
 		}
+		size rlen = os_read_stdin(result.s + result.len, cap - result.len);
+		if (!rlen)
+			break;
+		result.len += rlen;
+	}
+	return result;
+}
 
-		for (usize i = 1; i <= tdefs->len; i++) {
-			DictDef *def = alloc(a, DictDef, 1, ARENA_NO_CLEAR);
-			def->text = s8_dup(a, (s8){.len = tdefs[i].end - tdefs[i].start,
-			                           .s = data.s + tdefs[i].start});
-			def->next = (*n)->def;
-			(*n)->def = def;
+static b32
+get_stdin_line(Stream *buf)
+{
+	b32 result = 0;
+	for (; buf->widx < buf->cap; buf->widx++) {
+		u8 *c = buf->data + buf->widx;
+		if (!os_read_stdin(c, 1) || *c == (u8)-1) {
+			break;
+		} else if (*c == '\n') {
+			result = 1;
+			break;
 		}
 	}
+	return result;
+}
 
-cleanup:
-	stream_ensure_newline(&error_stream);
+static void
+make_result_cache(Arena *a)
+{
+	ResultCache *rc = &result_cache;
+	if (rc->blocks)
+		return;
+	rc->blocks = alloc(a, u8, RESULT_CACHE_BLOCKS * RESULT_CACHE_BLOCK_SIZE, ARENA_NO_CLEAR);
+	rc->next   = alloc(a, u32, RESULT_CACHE_BLOCKS, ARENA_NO_CLEAR);
+	rc->index  = alloc(a, u16, 1 << RESULT_CACHE_INDEX_EXP, 0);
+	rc->slots  = alloc(a, ResultCacheSlot, RESULT_CACHE_SLOTS, 0);
+	for (u32 i = 0; i < RESULT_CACHE_BLOCKS; i++)
+		rc->next[i] = i + 1 < RESULT_CACHE_BLOCKS ? i + 1 : RESULT_CACHE_END;
+	rc->nfree = RESULT_CACHE_BLOCKS;
 }
 
-static int
-make_dict(Arena *a, Dict *d)
+static b32
+result_cache_key_equal(ResultCache *rc, ResultCacheSlot *slot, s8 key)
 {
-	u8 *starting_arena_end = a->end;
-	Stream path = {.cap = 1 * MEGABYTE};
-	path.data   = alloc(a, u8, path.cap, ARENA_ALLOC_END|ARENA_NO_CLEAR);
-	d->ht.ents  = alloc(a, DictEnt *, 1 << HT_EXP, 0);
+	if (slot->key_len != key.len)
+		return 0;
+	u32 b = slot->first;
+	for (size off = 0; off < key.len; off += RESULT_CACHE_BLOCK_SIZE, b = rc->next[b]) {
+		s8 stored = {.len = MIN(RESULT_CACHE_BLOCK_SIZE, key.len - off),
+		             .s   = rc->blocks + (size)b * RESULT_CACHE_BLOCK_SIZE};
+		if (!s8_equal(stored, (s8){.len = stored.len, .s = key.s + off}))
+			return 0;
+	}
+	return 1;
+}
 
-	stream_append_s8(&path, prefix);
-	stream_append_s8(&path, os_path_sep);
-	stream_append_s8(&path, d->rom);
-	iptr path_stream = os_begin_path_stream(&path, a, ARENA_ALLOC_END);
+/* NOTE: returns the index position holding key or the free one it would take */
+static u32
+result_cache_probe(ResultCache *rc, u64 h, s8 key)
+{
+	u32 mask = (1u << RESULT_CACHE_INDEX_EXP) - 1;
+	u32 i    = h & mask;
+	for (; rc->index[i]; i = (i + 1) & mask) {
+		ResultCacheSlot *slot = rc->slots + rc->index[i] - 1;
+		if (slot->hash == h && result_cache_key_equal(rc, slot, key))
+			break;
+	}
+	return i;
+}
+
+static void
+result_cache_evict(ResultCache *rc, u32 id)
+{
+	ResultCacheSlot *slot = rc->slots + id;
+	u32 mask = (1u << RESULT_CACHE_INDEX_EXP) - 1;
+	u32 i    = slot->hash & mask;
+	while (rc->index[i] != id + 1)
+		i = (i + 1) & mask;
 
-	u8 *arena_end = a->end;
-	s8 fn_pre = s8("term");
-	for (s8 filedata = os_get_valid_file(path_stream, fn_pre, a, ARENA_ALLOC_END);
-	     filedata.len;
-	     filedata = os_get_valid_file(path_stream, fn_pre, a, ARENA_ALLOC_END))
-	{
-		parse_term_bank(a, &d->ht, filedata);
-		a->end = arena_end;
+	/* NOTE: entries after the hole move back into it unless that would put
+	 * them before their home position */
+	for (u32 j = (i + 1) & mask; rc->index[j]; j = (j + 1) & mask) {
+		u32 home = rc->slots[rc->index[j] - 1].hash & mask;
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			rc->index[i] = rc->index[j];
+			i = j;
+		}
 	}
-	os_end_path_stream(path_stream);
+	rc->index[i] = 0;
 
-	a->end = starting_arena_end;
+	for (u32 b = slot->first; b != RESULT_CACHE_END;) {
+		u32 next    = rc->next[b];
+		rc->next[b] = rc->free;
+		rc->free    = b;
+		rc->nfree++;
+		b = next;
+	}
+	slot->hash = 0;
+	stats.result_cache_evictions++;
+}
 
-	return 1;
+static void
+result_cache_append(ResultCache *rc, ResultCacheSlot *slot, s8 str)
+{
+	while (str.len) {
+		if (rc->fill == RESULT_CACHE_BLOCK_SIZE) {
+			u32 b       = rc->free;
+			rc->free    = rc->next[b];
+			rc->next[b] = RESULT_CACHE_END;
+			rc->nfree--;
+			if (slot->first == RESULT_CACHE_END) slot->first        = b;
+			else                                 rc->next[rc->tail] = b;
+			rc->tail = b;
+			rc->fill = 0;
+		}
+		u32 len = MIN(str.len, RESULT_CACHE_BLOCK_SIZE - rc->fill);
+		simd.copy(rc->blocks + (size)rc->tail * RESULT_CACHE_BLOCK_SIZE + rc->fill, str.s, len);
+		rc->fill  += len;
+		slot->len += len;
+		str.s     += len;
+		str.len   -= len;
+	}
 }
 
+/* NOTE: the result is everything buffered in s; parts of it may only be
+ * referenced by its iovecs so each of them is copied in turn followed by the
+ * bytes buffered after the last one */
 static void
-make_dicts(Arena *a, Dict *dicts, u32 ndicts)
+result_cache_store(ResultCache *rc, u64 h, s8 key, Stream *s)
 {
-	for (u32 i = 0; i < ndicts; i++) {
-		if (!make_dict(a, &dicts[i])) {
-			stream_append_s8(&error_stream, s8("make_dict failed for: "));
-			stream_append_s8(&error_stream, dicts[i].rom);
-			stream_append_byte(&error_stream, '\n');
+	size len = key.len + s->widx - s->mark;
+	for (u32 i = 0; i < s->iov_len; i++)
+		len += s->iov[i].len;
+	if (len > RESULT_CACHE_BLOCKS / 4 * RESULT_CACHE_BLOCK_SIZE)
+		return;
+
+	u32 nblocks = (len + RESULT_CACHE_BLOCK_SIZE - 1) / RESULT_CACHE_BLOCK_SIZE;
+	ResultCacheSlot *slot;
+	for (;;) {
+		slot     = rc->slots + rc->hand;
+		rc->hand = (rc->hand + 1) % RESULT_CACHE_SLOTS;
+		if (slot->hash && slot->referenced) {
+			slot->referenced = 0;
+			continue;
 		}
+		if (slot->hash)
+			result_cache_evict(rc, slot - rc->slots);
+		if (rc->nfree >= nblocks)
+			break;
 	}
+
+	*slot    = (ResultCacheSlot){.hash = h, .first = RESULT_CACHE_END, .key_len = key.len};
+	rc->fill = RESULT_CACHE_BLOCK_SIZE;
+	result_cache_append(rc, slot, key);
+	for (u32 i = 0; i < s->iov_len; i++)
+		result_cache_append(rc, slot, (s8){.len = s->iov[i].len, .s = s->iov[i].base});
+	result_cache_append(rc, slot, (s8){.len = s->widx - s->mark, .s = s->data + s->mark});
+	rc->index[result_cache_probe(rc, h, key)] = slot - rc->slots + 1;
 }
 
-static DictEnt *
-find_ent(s8 term, Dict *d)
+/* NOTE: blocks are only evicted by a store which never happens before the
+ * next flush so they are gathered by reference */
+static void
+stream_append_result(Stream *s, ResultCache *rc, ResultCacheSlot *slot)
 {
-	u64 h = hash(term);
-	i32 i = ht_lookup(h, HT_EXP, (i32)h);
-	return d->ht.ents[i];
+	u32 b = slot->first;
+	for (u32 off = 0; off < slot->len; off += RESULT_CACHE_BLOCK_SIZE, b = rc->next[b]) {
+		u32 start = off < slot->key_len ? MIN(slot->key_len - off, RESULT_CACHE_BLOCK_SIZE) : 0;
+		u32 end   = MIN(slot->len - off, RESULT_CACHE_BLOCK_SIZE);
+		u8 *block = rc->blocks + (size)b * RESULT_CACHE_BLOCK_SIZE;
+		if (end > start)
+			stream_append_ref(s, (s8){.len = end - start, .s = block + start});
+	}
 }
 
 static void
-find_and_print(s8 term, Dict *d)
+repl_parse_dict(Dict *d, u64 fingerprint)
 {
-	DictEnt *ent = find_ent(term, d);
+	d->tables      = arena_new(0, 0);
+	d->fingerprint = fingerprint;
+	parse_dict(&d->tables, d);
+}
 
-	if (!ent || !s8_equal(term, ent->term))
+/* NOTE: every table serving the repl is allocated from tables so that a
+ * reload can return all of them at once. without an image each dict is
+ * parsed into an arena of its own instead so that it can be replaced alone */
+static void
+repl_load(Arena *tables, Dict *dicts, u32 ndicts, b32 merged)
+{
+	if (image_dir.len && !dict_image)
+		load_shared_image(tables, dicts, ndicts);
+	if (dict_image || merged_index.ents)
 		return;
+	for (u32 i = 0; i < ndicts; i++)
+		repl_parse_dict(dicts + i, dict_fingerprint(tables, dicts + i));
+	if (merged)
+		make_merged_view(tables, dicts, ndicts);
+}
 
-	b32 print_for_readability = s8_equal(fsep, s8("\n"));
-	b32 printed_header        = 0;
-	for (DictDef *def = ent->def; def; def = def->next) {
-		if (print_for_readability)
-			def->text = unescape(def->text);
-		/* NOTE: some dictionaries are "hand-made" by idiots and have definitions
-		 * with only white space in them */
-		def->text = s8trim(def->text);
-		if (def->text.len) {
-			if (!print_for_readability) {
-				stream_append_s8(&stdout_stream, d->name);
-			} else if (!printed_header) {
-				stream_append_s8(&stdout_stream, s8("\x1b[36;1m"));
-				stream_append_s8(&stdout_stream, d->name);
-				stream_append_s8(&stdout_stream, s8("\x1b[0m"));
-				printed_header = 1;
-			}
+/* NOTE: drops the indices built over the dicts; they are all in tables */
+static void
+repl_drop_indices(Arena *tables)
+{
+	merged_index  = (struct ht){0};
+	term_index    = (TermIndex){0};
+	reverse_index = (ReverseIndex){0};
+	kanji_index   = (KanjiIndex){0};
+	segmenter     = (Segmenter){0};
+	result_cache  = (ResultCache){0};
+	arena_release((Arena){0}, tables);
+	*tables = arena_new(0, 0);
+}
 
-			stream_append_s8(&stdout_stream, fsep);
-			stream_append_s8(&stdout_stream, def->text);
-			stream_append_byte(&stdout_stream, '\n');
-		}
+static void
+repl_unload(Arena *tables)
+{
+	if (dict_image)
+		os_unmap(dict_image, dict_image->size);
+	if (dict_image_base.image)
+		os_unmap(dict_image_base.image, dict_image_base.image->size);
+	dict_image            = 0;
+	dict_image_base.image = 0;
+	for (u32 i = 0; i < ARRAY_COUNT(default_dict_map); i++) {
+		Dict *d = default_dict_map + i;
+		if (d->tables.block)
+			arena_release((Arena){0}, &d->tables);
+		*d = (Dict){.rom = d->rom, .name = d->name};
 	}
-	if (print_for_readability && printed_header)
-		stream_append_byte(&stdout_stream, '\n');
-	stream_flush(&stdout_stream);
+	repl_drop_indices(tables);
 }
 
+/* NOTE: parses only the dicts whose term banks changed, each into a new arena,
+ * while the tables they replace stay in place; they are swapped once every
+ * one is done. when a query comes in first the new arenas are dropped and 0
+ * is returned so that the reload is tried again once the repl is quiet */
+static b32
+repl_reparse(Arena *a, Arena *tables, Dict *dicts, u32 ndicts, b32 merged)
+{
+	/* NOTE: tables built for or served from an image are replaced whole */
+	b32 own = !dict_image;
+	for (u32 i = 0; i < ndicts; i++)
+		own &= dicts[i].tables.block != 0;
+	if (!own) {
+		repl_unload(tables);
+		repl_load(tables, dicts, ndicts, merged);
+		return 1;
+	}
+
+	Arena tmp     = *a;
+	Dict *next    = alloc(&tmp, Dict, ndicts, 0);
+	b32  *changed = alloc(&tmp, b32, ndicts, 0);
+	parse_yield   = 1;
+	parse_yielded = 0;
+	for (u32 i = 0; i < ndicts && !parse_yielded; i++) {
+		u64 fingerprint = dict_fingerprint(&tmp, dicts + i);
+		if (fingerprint == dicts[i].fingerprint)
+			continue;
+		next[i]    = (Dict){.rom = dicts[i].rom, .name = dicts[i].name};
+		changed[i] = 1;
+		repl_parse_dict(next + i, fingerprint);
+	}
+	parse_yield = 0;
+
+	for (u32 i = 0; i < ndicts; i++) {
+		if (!changed[i])
+			continue;
+		Dict *d = parse_yielded ? next + i : dicts + i;
+		arena_release((Arena){0}, &d->tables);
+		if (!parse_yielded)
+			*d = next[i];
+	}
+	b32 result = !parse_yielded;
+	if (result) {
+		repl_drop_indices(tables);
+		if (merged) make_merged_view(tables, dicts, ndicts);
+	}
+	arena_rewind(&tmp, *a);
+	return result;
+}
+
+/* NOTE: watches are added again after every change since yomichan-import may
+ * replace a dictionary folder instead of the banks in it */
 static void
-find_and_print_defs(Arena *a, Dict *dict, s8 *terms, u32 nterms)
+repl_watch(ReplReload *r, Arena *a)
 {
-	if (!make_dict(a, dict)) {
-		stream_append_s8(&error_stream, s8("failed to allocate dict: "));
-		stream_append_s8(&error_stream, dict->rom);
-		stream_append_byte(&stdout_stream, '\n');
+	if (r->watch < 0)
 		return;
+	Arena tmp   = *a;
+	Stream path = {.cap = 4096};
+	path.data   = alloc(&tmp, u8, path.cap, ARENA_NO_CLEAR);
+	stream_append_s8(&path, prefix);
+	stream_append_byte(&path, 0);
+	os_watch_path(r->watch, (char *)path.data);
+	for (u32 i = 0; i < ARRAY_COUNT(default_dict_map); i++) {
+		path.widx = 0;
+		stream_append_s8(&path, prefix);
+		stream_append_s8(&path, os_path_sep);
+		stream_append_s8(&path, default_dict_map[i].rom);
+		stream_append_byte(&path, 0);
+		os_watch_path(r->watch, (char *)path.data);
 	}
+	arena_rewind(&tmp, *a);
+}
 
-	for (u32 i = 0; i < nterms; i++)
-		find_and_print(terms[i], dict);
+/* NOTE: runs in the child which drops its copy of the tables; banks that
+ * did not change are copied from the image being replaced */
+static void __attribute__((noreturn))
+repl_build_image(Arena *tables, u64 key, u64 source_hash)
+{
+	Dict *dicts  = default_dict_map;
+	u32   ndicts = ARRAY_COUNT(default_dict_map);
+	repl_unload(tables);
+	DictImageHeader *stale = dict_image_map(tables, dicts, ndicts, key);
+	b32 ok = dict_image_publish(tables, dicts, ndicts, key, source_hash, stale);
+	stream_flush(&error_stream);
+	os_exit(!ok);
 }
 
+/* swaps in the image of a finished child and, once the term banks have been
+ * quiet for a while, starts rebuilding them if they changed. returns 1 when
+ * anything was reported */
 static b32
-get_stdin_line(Stream *buf)
+repl_reload(ReplReload *r, Arena *a, Arena *tables, Dict *dicts, u32 ndicts, b32 merged, b32 quiet)
 {
-	b32 result = 0;
-	for (; buf->widx < buf->cap; buf->widx++) {
-		u8 *c = buf->data + buf->widx;
-		if (!os_read_stdin(c, 1) || *c == (u8)-1) {
-			break;
-		} else if (*c == '\n') {
-			result = 1;
-			break;
+	b32 result = 0, ok;
+	if (r->builder && os_child_done(r->builder, &ok)) {
+		DictImageHeader *image = 0;
+		if (ok) image = dict_image_attach(a, default_dict_map, ARRAY_COUNT(default_dict_map),
+		                                  r->key, r->building_hash);
+		if (image) {
+			repl_unload(tables);
+			dict_image = image;
+			repl_load(tables, dicts, ndicts, merged);
+			stream_append_s8(&error_stream, s8("reloaded dictionaries\n"));
+		} else {
+			stream_append_s8(&error_stream, s8("failed to rebuild dictionaries\n"));
 		}
+		/* NOTE: a failed build is only retried once the banks change again */
+		r->builder     = 0;
+		r->loaded_hash = r->building_hash;
+		result         = 1;
 	}
-	return result;
+
+	if (!quiet || !r->changed || r->builder)
+		return result;
+
+	/* NOTE: without notifications the banks must look the same twice in a row
+	 * so that a dictionary which is still being written is not loaded */
+	u64 source_hash = dict_image_source_hash(a, default_dict_map, ARRAY_COUNT(default_dict_map));
+	if (r->watch < 0 && source_hash != r->polled_hash) {
+		r->polled_hash = source_hash;
+		return result;
+	}
+	r->changed = 0;
+	repl_watch(r, a);
+	if (source_hash == r->loaded_hash)
+		return result;
+
+	if (image_dir.len) {
+		r->building_hash = source_hash;
+		r->builder       = os_fork();
+		if (r->builder == 0)
+			repl_build_image(tables, r->key, source_hash);
+	}
+	if (r->builder > 0) {
+		stream_append_s8(&error_stream, s8("dictionaries changed; rebuilding\n"));
+	} else {
+		r->builder = 0;
+		if (!repl_reparse(a, tables, dicts, ndicts, merged)) {
+			r->changed = 1;
+			return result;
+		}
+		r->loaded_hash = source_hash;
+		stream_append_s8(&error_stream, s8("reloaded dictionaries\n"));
+	}
+	stream_flush(&error_stream);
+	return 1;
 }
 
 static void
-repl(Arena *a, Dict *dicts, u32 ndicts)
+repl(Arena *a, Dict *dicts, u32 ndicts, b32 merged, b32 reverse, b32 kanji, b32 segmented)
 {
 	Stream buf = {.cap = 4096};
 	buf.data   = alloc(a, u8, buf.cap, ARENA_NO_CLEAR);
+	u8 *query  = alloc(a, u8, NORMALIZE_MAX_LEN(buf.cap), ARENA_NO_CLEAR);
+
+	/* NOTE: kanji lookups never touch the term tables and the kanji banks are
+	 * not watched; neither an embedded image nor the kanji index is replaced */
+	Arena tables = arena_new(0, 0);
+	if (kanji) make_kanji_index(&tables, dicts, ndicts);
+	else       repl_load(&tables, dicts, ndicts, merged);
 
-	make_dicts(a, dicts, ndicts);
+	b32 fixed = EMBEDDED_IMAGE.len != 0 || kanji;
+	ReplReload reload  = {.watch = fixed ? -1 : os_watch_new(), .key = dict_image_key()};
+	reload.loaded_hash = dict_image ? dict_image->source_hash
+	                   : dict_image_source_hash(a, default_dict_map, ARRAY_COUNT(default_dict_map));
+	reload.polled_hash = reload.loaded_hash;
+	repl_watch(&reload, a);
+
+	/* NOTE: json output is only the objects so it can be consumed line by line */
+	s8 prompt = print_json ? (s8){0} : repl_prompt;
+	s8 quit   = print_json ? (s8){0} : repl_quit;
 
 	fsep = s8("\n");
 	for (;;) {
-		stream_append_s8(&stdout_stream, repl_prompt);
+		stream_append_s8(&stdout_stream, prompt);
 		stream_flush(&stdout_stream);
+
+		/* NOTE: lookups never wait on a reload; it only progresses between queries */
+		u32 input = 0;
+		while (!(input & OS_INPUT_READY)) {
+			b32 waiting = !fixed && (reload.watch < 0 || reload.changed || reload.builder);
+			input = os_wait_for_input(reload.watch, waiting ? REPL_RELOAD_PERIOD : -1);
+			if ((input & OS_INPUT_CHANGED) || (!input && reload.watch < 0))
+				reload.changed = 1;
+			if (!fixed && repl_reload(&reload, a, &tables, dicts, ndicts, merged, !input)) {
+				stream_flush(&error_stream);
+				if (!(input & OS_INPUT_READY)) {
+					stream_append_s8(&stdout_stream, prompt);
+					stream_flush(&stdout_stream);
+				}
+			}
+		}
+
 		if (!get_stdin_line(&buf))
 			break;
 		s8 trimmed = s8trim((s8){.len = buf.widx, .s = buf.data});
-		for (u32 i = 0; i < ndicts; i++)
-			find_and_print(trimmed, &dicts[i]);
+		if (s8_equal(trimmed, repl_stats_command)) {
+			dump_stats(&stdout_stream, dicts, ndicts);
+		} else {
+			s8 term = {.len = normalize_utf8(query, trimmed.s, trimmed.len, 0), .s = query};
+			make_result_cache(&tables);
+			/* NOTE: results are keyed by the query as typed since it is printed
+			 * with them; a result is only kept when it was written in one go */
+			u64 h    = hash(trimmed) | 1;
+			u32 slot = result_cache.index[result_cache_probe(&result_cache, h, trimmed)];
+			u64 flushes = stats.stream_flushes;
+			b32 empty   = !stdout_stream.widx && !stdout_stream.iov_len;
+			if (slot) {
+				stats.result_cache_hits++;
+				result_cache.slots[slot - 1].referenced = 1;
+				stream_append_result(&stdout_stream, &result_cache, result_cache.slots + slot - 1);
+			} else if (kanji) {
+				find_and_print_kanji(trimmed, term);
+			} else if (segmented) {
+				make_segmenter(&tables, dicts, ndicts);
+				segment_and_print(&tables, dicts, ndicts, merged, trimmed);
+			} else if (reverse || is_glob(term)) {
+				make_term_index(&tables, dicts, ndicts);
+				if (reverse) make_reverse_index(&tables, dicts, ndicts);
+				Arena tmp = *a;
+				i32 nterms  = 1;
+				s8 *queries = &trimmed;
+				s8 *terms   = expand_terms(&tmp, dicts, ndicts, &term, &nterms, &queries, reverse);
+				print_terms = 1;
+				if (merged) {
+					find_and_print_merged(&tmp, dicts, ndicts, queries, terms, nterms);
+				} else {
+					for (u32 i = 0; i < ndicts; i++)
+						find_and_print_defs(&tmp, &dicts[i], queries, terms, nterms);
+				}
+				print_terms = 0;
+				arena_rewind(&tmp, *a);
+			} else if (merged) {
+				find_and_print_merged(a, dicts, ndicts, &trimmed, &term, 1);
+			} else {
+				for (u32 i = 0; i < ndicts; i++)
+					find_and_print(a, trimmed, term, &dicts[i]);
+			}
+			if (!slot) {
+				stats.result_cache_misses++;
+				if (empty && flushes == stats.stream_flushes && !stdout_stream.errors)
+					result_cache_store(&result_cache, h, trimmed, &stdout_stream);
+			}
+		}
 		buf.widx = 0;
 	}
-	stream_append_s8(&stdout_stream, repl_quit);
+	stream_append_s8(&stdout_stream, quit);
 }
 
 static i32
@@ -541,7 +4477,10 @@ jdict(Arena *a, i32 argc, char *argv[])
 {
 	Dict *dicts = 0;
 	i32 ndicts = 0, nterms = 0;
-	i32 iflag = 0;
+	i32 aflag = 0, bflag = 0, iflag = 0, kflag = 0, mflag = 0, rflag = 0, sflag = 0;
+	char *image_path = 0, *trace_path = 0;
+
+	simd_init(os_cpu_features());
 
 	s8 argv0 = cstr_to_s8(argv[0]);
 	for (argv++, argc--; argv[0] && argv[0][0] == '-' && argv[0][1]; argc--, argv++) {
@@ -551,12 +4490,47 @@ jdict(Arena *a, i32 argc, char *argv[])
 			argc--;
 			break;
 		}
+		if (argv[0][1] == '-') {
+			s8 option = cstr_to_s8(argv[0]);
+			if (s8_equal(option, s8("--stats"))) {
+				sflag = 1;
+			} else if (s8_equal(option, s8("--memory"))) {
+				if (!argv[1] || !argv[1][0])
+					usage(argv0);
+				arena_budget = parse_memory_size(cstr_to_s8(argv[1]));
+				if (arena_budget < 0) {
+					stream_append_s8(&error_stream, s8("invalid memory size: "));
+					stream_append_s8(&error_stream, cstr_to_s8(argv[1]));
+					die(&error_stream);
+				}
+				argv++;
+				argc--;
+			} else if (s8_equal(option, s8("--mmap"))) {
+				use_mmap_reads = 1;
+			} else if (s8_equal(option, s8("--write-image"))) {
+				if (!argv[1] || !argv[1][0])
+					usage(argv0);
+				image_path = argv[1];
+				argv++;
+				argc--;
+			} else if (s8_equal(option, s8("--trace"))) {
+				if (!argv[1] || !argv[1][0])
+					usage(argv0);
+				trace_path = argv[1];
+				argv++;
+				argc--;
+			} else {
+				usage(argv0);
+			}
+			continue;
+		}
 		switch (argv[0][1]) {
 		case 'F':
 			if (!argv[1] || !argv[1][0])
 				usage(argv0);
 			fsep = unescape(cstr_to_s8(argv[1]));
 			argv++;
+			argc--;
 			break;
 		case 'd': {
 			if (!argv[1] || !argv[1][0])
@@ -575,38 +4549,138 @@ jdict(Arena *a, i32 argc, char *argv[])
 				die(&error_stream);
 			}
 			argv++;
+			argc--;
 		} break;
+		case 'a': aflag = 1;   break;
+		case 'b': bflag = 1;   break;
 		case 'i': iflag = 1;   break;
+		case 'j': print_json = 1; break;
+		case 'k': kflag = 1;   break;
+		case 'n':
+			if (!argv[1] || parse_count(cstr_to_s8(argv[1])) < 0)
+				usage(argv0);
+			print_limit = parse_count(cstr_to_s8(argv[1]));
+			argv++;
+			argc--;
+			break;
+		case 'm': mflag = 1;   break;
+		case 'r': rflag = 1;   break;
+		case 't':
+			if (!argv[1] || !argv[1][0])
+				usage(argv0);
+			tag_filter = cstr_to_s8(argv[1]);
+			argv++;
+			argc--;
+			break;
 		default: usage(argv0); break;
 		}
 	}
 
+	if (trace_path)
+		trace_init(a, TRACE_EVENTS);
+
 	if (ndicts == 0) {
 		dicts  = default_dict_map;
 		ndicts = ARRAY_COUNT(default_dict_map);
 	}
 
-	/* NOTE: remaining argv elements are search terms */
-	nterms = argc;
-	s8 *terms = alloc(a, s8, nterms, 0);
-	for (i32 i = 0; argc && *argv; argv++, i++, argc--)
-		terms[i] = cstr_to_s8(*argv);
+	/* NOTE: the image always holds every configured dictionary */
+	if (image_path) {
+		u32 nall = ARRAY_COUNT(default_dict_map);
+		u64 source_hash = dict_image_source_hash(a, default_dict_map, nall);
+		make_merged_index(a, default_dict_map, nall);
+		b32 ok = dict_image_write(a, default_dict_map, nall, image_path, source_hash);
+		stream_flush(&error_stream);
+		os_exit(!ok);
+	}
+
+	/* NOTE: remaining argv elements are search terms followed by any white
+	 * space separated terms read from stdin (-b) */
+	s8 input = {0};
+	i32 ninput = 0;
+	if (bflag) {
+		input = read_stdin(a);
+		for (size i = 0; i < input.len; i++)
+			ninput += !ISSPACE(input.s[i]) && (i + 1 == input.len || ISSPACE(input.s[i + 1]));
+	}
+
+	/* NOTE: queries are kept as typed for printing next to the terms they
+	 * are looked up as */
+	nterms = argc + ninput;
+	s8 *terms   = alloc(a, s8, nterms, 0);
+	s8 *queries = alloc(a, s8, nterms, 0);
+	for (i32 i = 0; argc && *argv; argv++, i++, argc--) {
+		queries[i] = cstr_to_s8(*argv);
+		terms[i]   = normalize_term(a, queries[i]);
+	}
+	for (i32 i = nterms - ninput; input.len; i++) {
+		input   = s8trim(input);
+		s8 term = input;
+		for (term.len = 0; term.len < input.len && !ISSPACE(input.s[term.len]); term.len++);
+		if (term.len) {
+			queries[i] = term;
+			terms[i]   = normalize_term(a, term);
+		}
+		input = s8_cut_head(input, term.len);
+	}
 
-	if (nterms == 0 && iflag == 0)
+	if (nterms == 0 && iflag == 0 && bflag == 0)
 		usage(argv0);
 
-	if (iflag == 0)
+	s8 embedded = EMBEDDED_IMAGE;
+	if (embedded.len) {
+		dict_image = dict_image_check(embedded, default_dict_map, ARRAY_COUNT(default_dict_map));
+		if (!dict_image) {
+			stream_append_s8(&error_stream, s8("embedded dictionary image does not match config.h\n"));
+			die(&error_stream);
+		}
+	}
+
+	/* NOTE: the repl loads its tables itself so that it can reload them */
+	if (image_dir.len && !iflag && !kflag && !dict_image)
+		load_shared_image(a, dicts, ndicts);
+
+	/* NOTE: reverse queries and wildcard terms are replaced by the terms they
+	 * match which needs every table up front */
+	b32 globs   = 0;
+	for (i32 i = 0; i < nterms; i++)
+		globs |= is_glob(terms[i]);
+	if ((globs || rflag) && nterms && !iflag && !kflag && !aflag) {
+		if (mflag) make_merged_index(a, dicts, ndicts);
+		else       make_dicts(a, dicts, ndicts);
+		make_term_index(a, dicts, ndicts);
+		if (rflag) make_reverse_index(a, dicts, ndicts);
+		terms       = expand_terms(a, dicts, ndicts, terms, &nterms, &queries, rflag);
+		print_terms = 1;
+	}
+
+	if (iflag == 0 && kflag) {
+		make_kanji_index(a, dicts, ndicts);
+		for (i32 i = 0; i < nterms; i++)
+			find_and_print_kanji(queries[i], terms[i]);
+	} else if (iflag == 0 && aflag) {
+		if (mflag) make_merged_index(a, dicts, ndicts);
+		else       make_dicts(a, dicts, ndicts);
+		make_segmenter(a, dicts, ndicts);
+		for (i32 i = 0; i < nterms; i++)
+			segment_and_print(a, dicts, ndicts, mflag, queries[i]);
+	} else if (iflag == 0 && mflag) {
+		make_merged_index(a, dicts, ndicts);
+		find_and_print_merged(a, dicts, ndicts, queries, terms, nterms);
+	} else if (iflag == 0) {
 		for (i32 i = 0; i < ndicts; i++)
-			find_and_print_defs(a, &dicts[i], terms, nterms);
-	else
-		repl(a, dicts, ndicts);
+			find_and_print_defs(a, &dicts[i], queries, terms, nterms);
+	} else {
+		repl(a, dicts, ndicts, mflag, rflag, kflag, aflag);
+	}
 
-#ifdef _DEBUG_ARENA
-	stream_append_s8(&error_stream, s8("min remaining arena capacity: "));
-	stream_append_u64(&error_stream, memory.min_capacity_remaining);
-	stream_append_s8(&error_stream, s8("\nremaining arena capacity: "));
-	stream_append_u64(&error_stream, memory.end - memory.beg);
-#endif
+	if (sflag) {
+		stream_flush(&stdout_stream);
+		dump_stats(&error_stream, dicts, ndicts);
+	}
+
+	if (trace_path)
+		trace_dump(*a, trace_path);
 
 	stream_ensure_newline(&error_stream);
 	stream_flush(&error_stream);
@@ -0,0 +1,158 @@
+/* See LICENSE for license details.
+ *
+ * normalize.c implements the folding applied to dictionary terms
+ * and queries so that spellings which only differ in script or
+ * width compare equal:
+ *
+ *   - katakana is folded to hiragana
+ *   - full-width ASCII and half-width katakana are folded to their
+ *     usual width
+ *   - combining (semi-)voiced sound marks are composed
+ *   - iteration marks (ゝゞ々) are expanded
+ *
+ * The output is never more than NORMALIZE_MAX_LEN(len) bytes.
+ */
+
+#define NORMALIZE_MAX_LEN(len) ((len) + (len) / 3 + 4)
+
+/* half-width katakana and punctuation U+FF61..U+FF9F */
+static u16 normalize_halfwidth[] = {
+	0x3002, 0x300C, 0x300D, 0x3001, 0x30FB, 0x30F2, 0x30A1, 0x30A3,
+	0x30A5, 0x30A7, 0x30A9, 0x30E3, 0x30E5, 0x30E7, 0x30C3, 0x30FC,
+	0x30A2, 0x30A4, 0x30A6, 0x30A8, 0x30AA, 0x30AB, 0x30AD, 0x30AF,
+	0x30B1, 0x30B3, 0x30B5, 0x30B7, 0x30B9, 0x30BB, 0x30BD, 0x30BF,
+	0x30C1, 0x30C4, 0x30C6, 0x30C8, 0x30CA, 0x30CB, 0x30CC, 0x30CD,
+	0x30CE, 0x30CF, 0x30D2, 0x30D5, 0x30D8, 0x30DB, 0x30DE, 0x30DF,
+	0x30E0, 0x30E1, 0x30E2, 0x30E4, 0x30E6, 0x30E8, 0x30E9, 0x30EA,
+	0x30EB, 0x30EC, 0x30ED, 0x30EF, 0x30F3, 0x3099, 0x309A,
+};
+
+/* returns the voiced form of hiragana c or 0 if it has none */
+static u32
+normalize_voiced(u32 c)
+{
+	if (c >= 0x304B && c <= 0x3062 && (c - 0x304B) % 2 == 0) return c + 1;
+	if (c == 0x3064 || c == 0x3066 || c == 0x3068)            return c + 1;
+	if (c >= 0x306F && c <= 0x307D && (c - 0x306F) % 3 == 0) return c + 1;
+	if (c == 0x3046)                                          return 0x3094;
+	if (c == 0x309D)                                          return 0x309E;
+	return 0;
+}
+
+static u32
+normalize_semivoiced(u32 c)
+{
+	if (c >= 0x306F && c <= 0x307D && (c - 0x306F) % 3 == 0) return c + 2;
+	return 0;
+}
+
+static b32
+normalize_is_kanji(u32 c)
+{
+	return (c >= 0x4E00 && c <= 0x9FFF) || (c >= 0x3400 && c <= 0x4DBF) ||
+	       (c >= 0xF900 && c <= 0xFAFF) || (c >= 0x20000 && c <= 0x3FFFF);
+}
+
+static u8 *
+normalize_put(u8 *out, u32 c)
+{
+	if (c < 0x80) {
+		*out++ = c;
+	} else if (c < 0x800) {
+		*out++ = 0xC0 | (c >> 6);
+		*out++ = 0x80 | (c & 0x3F);
+	} else if (c < 0x10000) {
+		*out++ = 0xE0 | (c >> 12);
+		*out++ = 0x80 | ((c >> 6) & 0x3F);
+		*out++ = 0x80 | (c & 0x3F);
+	} else {
+		*out++ = 0xF0 | (c >> 18);
+		*out++ = 0x80 | ((c >> 12) & 0x3F);
+		*out++ = 0x80 | ((c >> 6) & 0x3F);
+		*out++ = 0x80 | (c & 0x3F);
+	}
+	return out;
+}
+
+/* writes the normalized form of src to dst which must hold
+ * NORMALIZE_MAX_LEN(len) bytes; returns the number of bytes written.
+ * if offsets is set it must hold as many entries as dst and each byte
+ * written gets the offset in src of the code point it came from */
+static size
+normalize_utf8(u8 *dst, u8 *src, size len, i32 *offsets)
+{
+	u8 *out = dst, *beg = src, *end = src + len;
+	u8 *prev_out = 0; /* start of the last code point written */
+	u32 prev     = 0;
+
+	while (src < end) {
+		/* NOTE: runs of ASCII are copied a word at a time */
+		if (*src < 0x80) {
+			while (!offsets && end - src >= 8) {
+				u64 word;
+				__builtin_memcpy(&word, src, sizeof(word));
+				if (word & 0x8080808080808080ULL)
+					break;
+				__builtin_memcpy(out, &word, sizeof(word));
+				out += 8;
+				src += 8;
+			}
+			while (src < end && *src < 0x80) {
+				if (offsets) offsets[out - dst] = src - beg;
+				*out++ = *src++;
+			}
+			prev_out = out - 1;
+			prev     = *prev_out;
+			continue;
+		}
+
+		u32 c, n;
+		if      ((*src & 0xE0) == 0xC0) { c = *src & 0x1F; n = 2; }
+		else if ((*src & 0xF0) == 0xE0) { c = *src & 0x0F; n = 3; }
+		else if ((*src & 0xF8) == 0xF0) { c = *src & 0x07; n = 4; }
+		else                            { c = 0;           n = 0; }
+		for (u32 i = 1; n && i < n; i++) {
+			if (src + i >= end || (src[i] & 0xC0) != 0x80) n = 0;
+			else                                           c = (c << 6) | (src[i] & 0x3F);
+		}
+		if (!n) {
+			/* NOTE: invalid sequences are passed through a byte at a time */
+			if (offsets) offsets[out - dst] = src - beg;
+			prev_out = out;
+			prev     = 0;
+			*out++   = *src++;
+			continue;
+		}
+		src += n;
+
+		if      (c >= 0xFF01 && c <= 0xFF5E) c -= 0xFEE0;
+		else if (c == 0x3000)                c  = ' ';
+		else if (c >= 0xFF61 && c <= 0xFF9F) c  = normalize_halfwidth[c - 0xFF61];
+
+		if      (c >= 0x30A1 && c <= 0x30F6) c -= 0x60;
+		else if (c == 0x30FD || c == 0x30FE) c -= 0x60;
+
+		u32 composed = 0;
+		switch (c) {
+		case 0x3099: composed = normalize_voiced(prev);     break;
+		case 0x309A: composed = normalize_semivoiced(prev); break;
+		case 0x309D: if (prev >= 0x3041 && prev <= 0x3096) c = prev;                     break;
+		case 0x309E: if (normalize_voiced(prev))            c = normalize_voiced(prev);   break;
+		case 0x3005: if (normalize_is_kanji(prev))          c = prev;                     break;
+		}
+
+		if (composed) {
+			/* NOTE: every composed kana has the same encoded length as its base */
+			normalize_put(prev_out, composed);
+			prev = composed;
+		} else {
+			prev_out = out;
+			prev     = c;
+			out      = normalize_put(out, c);
+			for (u8 *o = prev_out; offsets && o < out; o++)
+				offsets[o - dst] = src - n - beg;
+		}
+	}
+
+	return out - dst;
+}
@@ -6,18 +6,72 @@
 #define PROT_READ     0x01
 #define PROT_WRITE    0x02
 #define PROT_RW       0x03
+#define MAP_SHARED    0x01
 #define MAP_PRIVATE   0x02
 #define MAP_ANON      0x20
+#define MAP_FIXED     0x10
+#define MAP_NORESERVE 0x4000
+#define MAP_POPULATE  0x8000
+#define MAP_HUGETLB   0x40000
+
+#define EINTR         4
+
+#define POSIX_FADV_SEQUENTIAL 2
+#define POSIX_FADV_WILLNEED   3
+#define MADV_WILLNEED         3
+#define MADV_DONTNEED         4
+#define MADV_HUGEPAGE         14
+
+/* NOTE: linux caps a single read at just under 2GB */
+#define READ_CHUNK_SIZE (1UL << 30)
+
+/* bounds for the getdents64 buffer; sized from the directory's st_size */
+#define DIRENT_BUF_MIN  (32 * 1024)
+#define DIRENT_BUF_MAX  (1 * MEGABYTE)
+
+#define IORING_OFF_SQ_RING      0x00000000ULL
+#define IORING_OFF_CQ_RING      0x08000000ULL
+#define IORING_OFF_SQES         0x10000000ULL
+#define IORING_FEAT_SINGLE_MMAP (1U << 0)
+#define IORING_ENTER_GETEVENTS  (1U << 0)
+#define IORING_OP_READ          22
 
 #define AT_FDCWD      (-100)
 
 #define O_RDONLY      0x00
+#define O_WRONLY      0x01
+#define O_CREAT       0x40
+#define O_EXCL        0x80
+#define O_TRUNC       0x200
+
+#define S_IFMT        0170000
+#define S_IFREG       0100000
 
 #define DT_REGULAR_FILE 8
 
+#define IN_NONBLOCK     0x800
+#define IN_CLOEXEC      0x80000
+#define IN_CLOSE_WRITE  0x008
+#define IN_MOVED_FROM   0x040
+#define IN_MOVED_TO     0x080
+#define IN_CREATE       0x100
+#define IN_DELETE       0x200
+#define IN_DELETE_SELF  0x400
+#define IN_MOVE_SELF    0x800
+
+#define POLLIN          0x001
+#define POLLHUP         0x010
+
+#define SIGCHLD         17
+#define WNOHANG         1
+
+#define AT_HWCAP        16
+
 typedef __attribute__((aligned(16))) u8 stat_buffer[144];
 #define STAT_BUF_MEMBER(sb, t, off) (*(t *)((u8 *)(sb) + off))
 #define STAT_FILE_SIZE(sb)  STAT_BUF_MEMBER(sb, u64,  48)
+#define STAT_MTIME_SEC(sb)  STAT_BUF_MEMBER(sb, u64,  88)
+#define STAT_MTIME_NSEC(sb) STAT_BUF_MEMBER(sb, u64,  96)
 
 #define DIRENT_BUF_MEMBER(db, t, off) (*(t *)((u8 *)(db) + off))
 #define DIRENT_RECLEN(db) DIRENT_BUF_MEMBER(db, u16,    16)
@@ -28,15 +82,93 @@ static i64 syscall1(i64, i64);
 static i64 syscall2(i64, i64, i64);
 static i64 syscall3(i64, i64, i64, i64);
 static i64 syscall4(i64, i64, i64, i64, i64);
+static i64 syscall5(i64, i64, i64, i64, i64, i64);
 static i64 syscall6(i64, i64, i64, i64, i64, i64, i64);
 
 typedef struct {
-	u8   buf[2048];
+	u32 head, tail, ring_mask, ring_entries, flags, dropped, array, resv1;
+	u64 user_addr;
+} IOSQRingOffsets;
+
+typedef struct {
+	u32 head, tail, ring_mask, ring_entries, overflow, cqes, flags, resv1;
+	u64 user_addr;
+} IOCQRingOffsets;
+
+typedef struct {
+	u32 sq_entries, cq_entries, flags, sq_thread_cpu, sq_thread_idle, features, wq_fd;
+	u32 resv[3];
+	IOSQRingOffsets sq_off;
+	IOCQRingOffsets cq_off;
+} IOUringParams;
+
+typedef struct {
+	u8  opcode;
+	u8  flags;
+	u16 ioprio;
+	i32 fd;
+	u64 off;
+	u64 addr;
+	u32 len;
+	u32 rw_flags;
+	u64 user_data;
+	u64 pad[3];
+} IOUringSQE;
+
+typedef struct {
+	u64 user_data;
+	i32 res;
+	u32 flags;
+} IOUringCQE;
+
+typedef struct {
+	iptr fd;
+	u32 *sq_head, *sq_tail, *sq_mask, *sq_array;
+	u32 *cq_head, *cq_tail, *cq_mask;
+	IOUringSQE *sqes;
+	IOUringCQE *cqes;
+	u8  *sq_ring, *cq_ring;
+	u64  sq_ring_size, cq_ring_size, sqes_size;
+	u32  to_submit;
+} LinuxIOUring;
+
+enum read_ahead_state {
+	READ_AHEAD_SYNC,
+	READ_AHEAD_IN_FLIGHT,
+	READ_AHEAD_DONE,
+	READ_AHEAD_MAPPED,
+};
+
+typedef struct {
+	u8  *buf;
+	iptr fd;
+	u64  size;
+	u64  done;
+	u32  state;
+	TraceZone zone;
+	char name[256];
+} ReadAheadSlot;
+
+/* NOTE: slots form a queue of upcoming files in directory order. the head is
+ * handed to the caller while the following reads are in flight */
+typedef struct {
+	u8  *buf;
+	i32  buf_cap;
 	iptr fd;
 	i32  buf_pos;
 	i32  buf_end;
+	s8   match_prefix;
+	b32  exhausted;
+	b32  head_in_use;
+	u32  head;
+	u32  count;
+	LinuxIOUring  ring;
+	ReadAheadSlot slots[READ_AHEAD_DEPTH];
 } LinuxDirectoryStream;
 
+/* NOTE: cpu features reported by the kernel in the auxiliary vector */
+static u64 linux_hwcap;
+
 /* NOTE: necessary garbage required by GCC/CLANG even when -nostdlib is used */
 __attribute((section(".text.memset")))
 void *memset(void *d, int c, usize n)
@@ -63,15 +195,241 @@ os_write(iptr fd, s8 raw)
 }
 
 static b32
+os_writev(iptr fd, IOVec *iov, u32 count)
+{
+	while (count) {
+		size r = syscall3(SYS_writev, fd, (iptr)iov, count);
+		if (r < 0) return 0;
+		/* NOTE: on a short write skip what was written and go again */
+		for (; count && r >= (size)iov->len; count--, iov++)
+			r -= iov->len;
+		if (count) {
+			iov->base = (u8 *)iov->base + r;
+			iov->len -= r;
+		}
+	}
+	return 1;
+}
+
+static size
 os_read_stdin(u8 *buf, size count)
 {
 	size rlen = syscall3(SYS_read, 0, (iptr)buf, count);
-	return rlen == count;
+	if (rlen > 0) stats.bytes_read += rlen;
+	return rlen > 0 ? rlen : 0;
+}
+
+static iptr
+os_open_for_write(char *path)
+{
+	u64 fd = syscall4(SYS_openat, AT_FDCWD, (iptr)path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd > -4096UL) return -1;
+	return fd;
+}
+
+static void
+os_close(iptr fd)
+{
+	syscall1(SYS_close, fd);
+}
+
+static void
+linux_read_all(iptr fd, u8 *buf, u64 len, char *file)
+{
+	syscall4(SYS_fadvise64, fd, 0, len, POSIX_FADV_SEQUENTIAL);
+	for (u64 done = 0; done < len;) {
+		u64 chunk = len - done;
+		if (chunk > READ_CHUNK_SIZE) chunk = READ_CHUNK_SIZE;
+		size rlen = syscall3(SYS_read, fd, (iptr)(buf + done), chunk);
+		if (rlen == -EINTR)
+			continue;
+		if (rlen <= 0) {
+			stream_append_s8(&error_stream, s8("failed to read whole file: "));
+			stream_append_s8(&error_stream, cstr_to_s8(file));
+			die(&error_stream);
+		}
+		done             += rlen;
+		stats.bytes_read += rlen;
+	}
+}
+
+static s8
+linux_map_file(char *path, b32 private)
+{
+	s8 result = {0};
+	u64 fd = syscall4(SYS_openat, AT_FDCWD, (iptr)path, O_RDONLY|(private ? O_NOFOLLOW : 0), 0);
+	if (fd > -4096UL)
+		return result;
+
+	stat_buffer sb;
+	b32 ok = syscall2(SYS_fstat, fd, (iptr)sb) == 0;
+	if (ok && private)
+		ok = (STAT_MODE(sb) & S_IFMT) == S_IFREG && (STAT_MODE(sb) & 022) == 0 &&
+		     STAT_UID(sb) == (u32)syscall1(SYS_geteuid, 0);
+	if (ok && STAT_FILE_SIZE(sb)) {
+		u64 size = STAT_FILE_SIZE(sb);
+		u64 map  = syscall6(SYS_mmap, 0, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map <= -4096UL) {
+			result.s   = (u8 *)map;
+			result.len = size;
+		}
+	}
+	syscall1(SYS_close, fd);
+	return result;
+}
+
+static s8
+os_map_file(char *path)
+{
+	return linux_map_file(path, 0);
+}
+
+/* NOTE: only maps a regular file owned by the user that no one else can
+ * write to; for files found in directories shared with other users */
+static s8
+os_map_private_file(char *path)
+{
+	return linux_map_file(path, 1);
+}
+
+/* NOTE: data is written to a temporary file and renamed into place so that
+ * readers only ever see complete files. the temporary file must be new so
+ * that no one else can have it open */
+static b32
+os_publish_file(char *path, s8 data)
+{
+	u8 tmp_path[4096];
+	Stream tmp = {.data = tmp_path, .cap = sizeof(tmp_path)};
+	stream_append_s8(&tmp, cstr_to_s8(path));
+	stream_append_s8(&tmp, s8(".tmp."));
+	stream_append_u64(&tmp, syscall1(SYS_getpid, 0));
+	stream_append_byte(&tmp, 0);
+	if (tmp.errors)
+		return 0;
+
+	u64 fd = syscall4(SYS_openat, AT_FDCWD, (iptr)tmp_path, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0644);
+	if (fd > -4096UL)
+		return 0;
+	b32 result = os_write(fd, data);
+	syscall1(SYS_close, fd);
+
+	if (result) result = syscall5(SYS_renameat2, AT_FDCWD, (iptr)tmp_path, AT_FDCWD, (iptr)path, 0) == 0;
+	if (!result) syscall3(SYS_unlinkat, AT_FDCWD, (iptr)tmp_path, 0);
+
+	return result;
+}
+
+/* order independent hash of the name, size and mtime of each matching file */
+static u64
+os_dir_fingerprint(char *path, s8 match_prefix)
+{
+	u64 fd = syscall4(SYS_openat, AT_FDCWD, (iptr)path, O_DIRECTORY|O_RDONLY, 0);
+	if (fd > -4096UL) {
+		/* NOTE: not a directory; fingerprint the archive itself */
+		stat_buffer sb;
+		if (syscall4(SYS_newfstatat, AT_FDCWD, (iptr)path, (iptr)sb, 0) != 0)
+			return 0;
+		u64 h = STAT_FILE_SIZE(sb) * 1111111111111111111;
+		h = (h ^ STAT_MTIME_SEC(sb))  * 1111111111111111111;
+		h = (h ^ STAT_MTIME_NSEC(sb)) * 1111111111111111111;
+		return h;
+	}
+
+	u64 result = 0;
+	__attribute__((aligned(8))) u8 buf[DIRENT_BUF_MIN];
+	for (;;) {
+		u64 ret = syscall3(SYS_getdents64, fd, (iptr)buf, sizeof(buf));
+		if (ret == 0 || ret > -4096UL)
+			break;
+		for (u64 pos = 0; pos < ret; pos += DIRENT_RECLEN(buf + pos)) {
+			char *name = DIRENT_NAME(buf + pos);
+			if (DIRENT_TYPE(buf + pos) != DT_REGULAR_FILE)
+				continue;
+			s8 sname = cstr_to_s8(name);
+			if (sname.len < match_prefix.len ||
+			    !s8_equal((s8){.len = match_prefix.len, .s = sname.s}, match_prefix))
+				continue;
+
+			stat_buffer sb;
+			if (syscall4(SYS_newfstatat, fd, (iptr)name, (iptr)sb, 0) != 0)
+				continue;
+			u64 h = hash(sname);
+			h = (h ^ STAT_FILE_SIZE(sb))  * 1111111111111111111;
+			h = (h ^ STAT_MTIME_SEC(sb))  * 1111111111111111111;
+			h = (h ^ STAT_MTIME_NSEC(sb)) * 1111111111111111111;
+			result += h;
+		}
+	}
+	syscall1(SYS_close, fd);
+
+	return result;
+}
+
+static iptr
+os_watch_new(void)
+{
+	u64 fd = syscall1(SYS_inotify_init1, IN_NONBLOCK|IN_CLOEXEC);
+	if (fd > -4096UL) return -1;
+	return fd;
+}
+
+/* NOTE: missing paths are ignored; they are retried on the next change */
+static void
+os_watch_path(iptr watch, char *path)
+{
+	u32 mask = IN_CLOSE_WRITE|IN_MOVED_FROM|IN_MOVED_TO|IN_CREATE|IN_DELETE
+	           |IN_DELETE_SELF|IN_MOVE_SELF;
+	syscall3(SYS_inotify_add_watch, watch, (iptr)path, mask);
+}
+
+/* waits up to timeout_ms (forever when negative) for stdin or a change */
+static u32
+os_wait_for_input(iptr watch, i32 timeout_ms)
+{
+	struct { i32 fd; u16 events, revents; } fds[2] = {
+		{.fd = 0,     .events = POLLIN},
+		{.fd = watch, .events = POLLIN},
+	};
+	i64 ts[2] = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+
+	u32 result = 0;
+	i64 ready  = syscall5(SYS_ppoll, (iptr)fds, watch < 0 ? 1 : 2, timeout_ms < 0 ? 0 : (iptr)ts, 0, 8);
+	if (ready == -EINTR)
+		return result;
+	/* NOTE: on errors let the read report the state of stdin */
+	if (ready < 0 || fds[0].revents & (POLLIN|POLLHUP))
+		result |= OS_INPUT_READY;
+	if (watch >= 0 && fds[1].revents & POLLIN) {
+		__attribute__((aligned(8))) u8 events[4096];
+		while (syscall3(SYS_read, watch, (iptr)events, sizeof(events)) > 0);
+		result |= OS_INPUT_CHANGED;
+	}
+	return result;
+}
+
+static iptr
+os_fork(void)
+{
+	i64 pid = syscall5(SYS_clone, SIGCHLD, 0, 0, 0, 0);
+	return pid < 0 ? -1 : pid;
+}
+
+/* NOTE: never blocks; ok is set when the child exited with status 0 */
+static b32
+os_child_done(iptr pid, b32 *ok)
+{
+	i32 status = 0;
+	i64 result = syscall4(SYS_wait4, pid, (iptr)&status, WNOHANG, 0);
+	if (result == 0)
+		return 0;
+	*ok = result == pid && (status & 0xFF7F) == 0;
+	return 1;
 }
 
 static s8
 os_read_whole_file_at(char *file, iptr dir_fd, Arena *a, u32 arena_flags)
 {
+	TraceZone zone = trace_begin(s8("os_read_whole_file_at"), cstr_to_s8(file));
 	u64 fd = syscall4(SYS_openat, dir_fd, (iptr)file, O_RDONLY, 0);
 	if (fd > -4096UL) {
 		stream_append_s8(&error_stream, s8("failed to open: "));
@@ -89,41 +447,292 @@ os_read_whole_file_at(char *file, iptr dir_fd, Arena *a, u32 arena_flags)
 
 	u64 file_size = STAT_FILE_SIZE(sb);
 	s8 result = {.len = file_size, .s = alloc(a, u8, file_size, arena_flags|ARENA_NO_CLEAR)};
-	size rlen = syscall3(SYS_read, fd, (iptr)result.s, result.len);
+	linux_read_all(fd, result.s, result.len, file);
 	syscall1(SYS_close, fd);
-
-	if (rlen != result.len) {
-		stream_append_s8(&error_stream, s8("failed to read whole file: "));
-		stream_append_s8(&error_stream, cstr_to_s8(file));
-		die(&error_stream);
-	}
+	trace_end(zone);
 
 	return result;
 }
 
+/* NOTE: explicit huge pages are only used when the system has reserved enough of
+ * them; otherwise the mapping is aligned and transparent huge pages are requested */
 static Arena
 os_new_arena(size requested_size)
 {
 	Arena result = {0};
 
 	size alloc_size = requested_size;
-	if (alloc_size % PAGESIZE != 0)
-		alloc_size += PAGESIZE - alloc_size % PAGESIZE;
-
-	u64 memory = syscall6(SYS_mmap, 0, alloc_size, PROT_RW, MAP_ANON|MAP_PRIVATE, -1, 0);
-	if (memory <= -4096UL) {
-		result.beg = (void *)memory;
-		result.end = result.beg + alloc_size;
-#ifdef _DEBUG_ARENA
-		result.min_capacity_remaining = alloc_size;
-#endif
+	if (alloc_size % HUGEPAGE_SIZE != 0)
+		alloc_size += HUGEPAGE_SIZE - alloc_size % HUGEPAGE_SIZE;
+
+	u64 memory = syscall6(SYS_mmap, 0, alloc_size, PROT_RW,
+	                      MAP_ANON|MAP_PRIVATE|MAP_HUGETLB, -1, 0);
+	if (memory > -4096UL) {
+		memory = syscall6(SYS_mmap, 0, alloc_size + HUGEPAGE_SIZE, PROT_RW,
+		                  MAP_ANON|MAP_PRIVATE|MAP_NORESERVE, -1, 0);
+		if (memory > -4096UL)
+			return result;
+		u64 slack = -memory & (HUGEPAGE_SIZE - 1);
+		if (slack)
+			syscall2(SYS_munmap, memory, slack);
+		syscall2(SYS_munmap, memory + slack + alloc_size, HUGEPAGE_SIZE - slack);
+		memory += slack;
+		syscall3(SYS_madvise, memory, alloc_size, MADV_HUGEPAGE);
 	}
 
+	result.beg = (void *)memory;
+	result.end = result.beg + alloc_size;
+	stats.arena_capacity += alloc_size;
+
 	return result;
 }
 
+static void
+os_unmap(void *memory, size len)
+{
+	syscall2(SYS_munmap, (iptr)memory, len);
+}
+
+static void
+os_zero_pages(void *memory, size len)
+{
+	u8 *beg = memory, *end = beg + len;
+	u8 *page_beg = (u8 *)(((usize)beg + PAGESIZE - 1) & ~(usize)(PAGESIZE - 1));
+	u8 *page_end = (u8 *)((usize)end & ~(usize)(PAGESIZE - 1));
+	if (page_beg >= page_end) {
+		mem_clear(beg, 0, len);
+		return;
+	}
+	mem_clear(beg, 0, page_beg - beg);
+	/* NOTE: fails on explicit huge pages unless the range is huge page aligned */
+	if (syscall3(SYS_madvise, (iptr)page_beg, page_end - page_beg, MADV_DONTNEED))
+		mem_clear(page_beg, 0, page_end - page_beg);
+	mem_clear(page_end, 0, end - page_end);
+}
+
+static b32
+linux_io_uring_init(LinuxIOUring *r, u32 entries)
+{
+	IOUringParams p = {0};
+	u64 fd = syscall2(SYS_io_uring_setup, entries, (iptr)&p);
+	if (fd > -4096UL)
+		return 0;
+
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+	r->cq_ring_size = p.cq_off.cqes  + p.cq_entries * sizeof(IOUringCQE);
+	r->sqes_size    = p.sq_entries * sizeof(IOUringSQE);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_ring_size > r->sq_ring_size) r->sq_ring_size = r->cq_ring_size;
+		r->cq_ring_size = 0;
+	}
+
+	u64 sq_ring = syscall6(SYS_mmap, 0, r->sq_ring_size, PROT_RW, MAP_SHARED|MAP_POPULATE,
+	                       fd, IORING_OFF_SQ_RING);
+	u64 cq_ring = sq_ring;
+	if (r->cq_ring_size)
+		cq_ring = syscall6(SYS_mmap, 0, r->cq_ring_size, PROT_RW, MAP_SHARED|MAP_POPULATE,
+		                   fd, IORING_OFF_CQ_RING);
+	u64 sqes = syscall6(SYS_mmap, 0, r->sqes_size, PROT_RW, MAP_SHARED|MAP_POPULATE,
+	                    fd, IORING_OFF_SQES);
+	if (sq_ring > -4096UL || cq_ring > -4096UL || sqes > -4096UL) {
+		syscall1(SYS_close, fd);
+		return 0;
+	}
+
+	r->fd       = fd;
+	r->sq_ring  = (u8 *)sq_ring;
+	r->cq_ring  = (u8 *)cq_ring;
+	r->sq_head  = (u32 *)(r->sq_ring + p.sq_off.head);
+	r->sq_tail  = (u32 *)(r->sq_ring + p.sq_off.tail);
+	r->sq_mask  = (u32 *)(r->sq_ring + p.sq_off.ring_mask);
+	r->sq_array = (u32 *)(r->sq_ring + p.sq_off.array);
+	r->cq_head  = (u32 *)(r->cq_ring + p.cq_off.head);
+	r->cq_tail  = (u32 *)(r->cq_ring + p.cq_off.tail);
+	r->cq_mask  = (u32 *)(r->cq_ring + p.cq_off.ring_mask);
+	r->cqes     = (IOUringCQE *)(r->cq_ring + p.cq_off.cqes);
+	r->sqes     = (IOUringSQE *)sqes;
+
+	return 1;
+}
+
+static void
+linux_io_uring_release(LinuxIOUring *r)
+{
+	syscall2(SYS_munmap, (iptr)r->sqes, r->sqes_size);
+	if (r->cq_ring_size)
+		syscall2(SYS_munmap, (iptr)r->cq_ring, r->cq_ring_size);
+	syscall2(SYS_munmap, (iptr)r->sq_ring, r->sq_ring_size);
+	syscall1(SYS_close, r->fd);
+}
+
+static void
+linux_io_uring_submit_read(LinuxIOUring *r, ReadAheadSlot *slot, u64 slot_index)
+{
+	u32 tail = *r->sq_tail;
+	u32 idx  = tail & *r->sq_mask;
+
+	IOUringSQE *sqe = r->sqes + idx;
+	*sqe = (IOUringSQE){
+		.opcode    = IORING_OP_READ,
+		.fd        = slot->fd,
+		.off       = slot->done,
+		.addr      = (u64)(slot->buf + slot->done),
+		.len       = slot->size - slot->done,
+		.user_data = slot_index,
+	};
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+}
+
+/* submits any queued reads and handles completions; blocks until at least
+ * min_complete reads have completed */
+static void
+linux_io_uring_enter(LinuxDirectoryStream *lds, u32 min_complete)
+{
+	LinuxIOUring *r = &lds->ring;
+	u32 flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+	i64 status;
+	do {
+		status = syscall6(SYS_io_uring_enter, r->fd, r->to_submit, min_complete, flags, 0, 0);
+	} while (status == -EINTR);
+	if (status < 0) {
+		stream_append_s8(&error_stream, s8("os_get_valid_file: SYS_io_uring_enter"));
+		die(&error_stream);
+	}
+	r->to_submit = 0;
+
+	u32 head = *r->cq_head;
+	u32 tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		IOUringCQE    *cqe  = r->cqes + (head & *r->cq_mask);
+		ReadAheadSlot *slot = lds->slots + cqe->user_data;
+		if (cqe->res <= 0) {
+			stream_append_s8(&error_stream, s8("failed to read whole file: "));
+			stream_append_s8(&error_stream, cstr_to_s8(slot->name));
+			die(&error_stream);
+		}
+		slot->done       += cqe->res;
+		stats.bytes_read += cqe->res;
+		if (slot->done < slot->size) {
+			/* NOTE: short read; queue the remainder */
+			linux_io_uring_submit_read(r, slot, cqe->user_data);
+		} else {
+			syscall1(SYS_close, slot->fd);
+			slot->state = READ_AHEAD_DONE;
+			trace_end(slot->zone);
+		}
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static char *
+linux_next_valid_name(LinuxDirectoryStream *lds)
+{
+	for (;;) {
+		if (lds->buf_pos >= lds->buf_end) {
+			u64 ret = syscall3(SYS_getdents64, lds->fd, (iptr)lds->buf, lds->buf_cap);
+			if (ret > -4096UL) {
+				stream_append_s8(&error_stream, s8("os_get_valid_file: SYS_getdents"));
+				die(&error_stream);
+			}
+			if (ret == 0)
+				return 0;
+			lds->buf_end = ret;
+			lds->buf_pos = 0;
+		}
+		u16  record_len = DIRENT_RECLEN(lds->buf + lds->buf_pos);
+		u8   type       = DIRENT_TYPE(lds->buf + lds->buf_pos);
+		char *name      = DIRENT_NAME(lds->buf + lds->buf_pos);
+		lds->buf_pos += record_len;
+		if (type == DT_REGULAR_FILE) {
+			b32 valid = 1;
+			for (size i = 0; i < lds->match_prefix.len; i++) {
+				if (lds->match_prefix.s[i] != name[i]) {
+					valid = 0;
+					break;
+				}
+			}
+			if (valid)
+				return name;
+		}
+	}
+}
+
+/* fills the read ahead queue; files are either mapped or read through io_uring.
+ * files which don't fit in a slot (or when io_uring is unavailable) are read
+ * synchronously when they reach the head */
+static void
+linux_queue_reads(LinuxDirectoryStream *lds)
+{
+	while (!lds->exhausted && lds->count < READ_AHEAD_DEPTH) {
+		char *name = linux_next_valid_name(lds);
+		if (!name) {
+			lds->exhausted = 1;
+			break;
+		}
+
+		u32 slot_index = (lds->head + lds->count++) % READ_AHEAD_DEPTH;
+		ReadAheadSlot *slot = lds->slots + slot_index;
+		u32 i;
+		for (i = 0; name[i] && i < sizeof(slot->name) - 1; i++)
+			slot->name[i] = name[i];
+		slot->name[i] = 0;
+		slot->state   = READ_AHEAD_SYNC;
+
+		if (!lds->ring.sqes && !use_mmap_reads)
+			continue;
+
+		u64 fd = syscall4(SYS_openat, lds->fd, (iptr)slot->name, O_RDONLY, 0);
+		if (fd > -4096UL) {
+			stream_append_s8(&error_stream, s8("failed to open: "));
+			stream_append_s8(&error_stream, cstr_to_s8(slot->name));
+			die(&error_stream);
+		}
+		stat_buffer sb;
+		u64 status = syscall2(SYS_fstat, fd, (iptr)sb);
+		if (status > -4096UL) {
+			stream_append_s8(&error_stream, s8("failed to stat: "));
+			stream_append_s8(&error_stream, cstr_to_s8(slot->name));
+			die(&error_stream);
+		}
+
+		u64 file_size = STAT_FILE_SIZE(sb);
+		if (use_mmap_reads && file_size) {
+			u64 map = syscall6(SYS_mmap, 0, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			syscall1(SYS_close, fd);
+			if (map <= -4096UL) {
+				syscall3(SYS_madvise, map, file_size, MADV_WILLNEED);
+				slot->buf         = (u8 *)map;
+				slot->size        = file_size;
+				slot->state       = READ_AHEAD_MAPPED;
+				stats.bytes_read += file_size;
+			}
+			continue;
+		}
+
+		if (file_size == 0 || file_size > READ_AHEAD_SLOT_SIZE) {
+			syscall1(SYS_close, fd);
+			continue;
+		}
+
+		/* NOTE: start kernel readahead before the ring gets to the request */
+		syscall4(SYS_fadvise64, fd, 0, file_size, POSIX_FADV_WILLNEED);
+
+		slot->fd       = fd;
+		slot->size     = file_size;
+		slot->done     = 0;
+		slot->state    = READ_AHEAD_IN_FLIGHT;
+		slot->zone     = trace_begin(s8("io_uring read"), cstr_to_s8(slot->name));
+		slot->zone.tid = 1;
+		linux_io_uring_submit_read(&lds->ring, slot, slot_index);
+	}
+	if (lds->ring.to_submit)
+		linux_io_uring_enter(lds, 0);
+}
+
 static iptr
-os_begin_path_stream(Stream *dir_name, Arena *a, u32 arena_flags)
+os_begin_path_stream(Stream *dir_name, s8 match_prefix, Arena *a, u32 arena_flags)
 {
 	stream_append_byte(dir_name, 0);
 	u64 fd = syscall4(SYS_openat, AT_FDCWD, (iptr)dir_name->data, O_DIRECTORY|O_RDONLY, 0);
@@ -134,8 +743,24 @@ os_begin_path_stream(Stream *dir_name, Arena *a, u32 arena_flags)
 		die(&error_stream);
 	}
 
+	/* NOTE: directory size roughly tracks the number of entries; use it to size
+	 * the dirent buffer so large folders need fewer getdents64 calls */
+	stat_buffer sb;
+	u64 dir_size = 0;
+	if (syscall2(SYS_fstat, fd, (iptr)sb) == 0)
+		dir_size = STAT_FILE_SIZE(sb);
+	if (dir_size < DIRENT_BUF_MIN) dir_size = DIRENT_BUF_MIN;
+	if (dir_size > DIRENT_BUF_MAX) dir_size = DIRENT_BUF_MAX;
+
 	LinuxDirectoryStream *lds = alloc(a, LinuxDirectoryStream, 1, arena_flags);
-	lds->fd = fd;
+	lds->fd           = fd;
+	lds->match_prefix = match_prefix;
+	lds->buf_cap      = dir_size;
+	lds->buf          = alloc(a, u8, lds->buf_cap, arena_flags|ARENA_NO_CLEAR);
+	if (!use_mmap_reads && linux_io_uring_init(&lds->ring, 2 * READ_AHEAD_DEPTH)) {
+		for (u32 i = 0; i < READ_AHEAD_DEPTH; i++)
+			lds->slots[i].buf = alloc(a, u8, READ_AHEAD_SLOT_SIZE, arena_flags|ARENA_NO_CLEAR);
+	}
 	return (iptr)lds;
 }
 
@@ -143,45 +768,51 @@ static void
 os_end_path_stream(iptr path_stream)
 {
 	LinuxDirectoryStream *lds = (LinuxDirectoryStream *)path_stream;
+	for (u32 i = 0; i < READ_AHEAD_DEPTH; i++)
+		if (lds->slots[i].state == READ_AHEAD_MAPPED)
+			syscall2(SYS_munmap, (iptr)lds->slots[i].buf, lds->slots[i].size);
+	if (lds->ring.sqes) {
+		/* NOTE: reads may still be in flight if the caller stopped early */
+		for (u32 i = 0; i < READ_AHEAD_DEPTH; i++)
+			while (lds->slots[i].state == READ_AHEAD_IN_FLIGHT)
+				linux_io_uring_enter(lds, 1);
+		linux_io_uring_release(&lds->ring);
+	}
 	syscall1(SYS_close, (iptr)lds->fd);
 }
 
+/* NOTE: name is set to the name of the returned file which stays valid until
+ * the next call */
 static s8
-os_get_valid_file(iptr path_stream, s8 match_prefix, Arena *a, u32 arena_flags)
+os_get_valid_file(iptr path_stream, Arena *a, u32 arena_flags, s8 *name)
 {
 	s8 result = {0};
 	if (path_stream) {
 		LinuxDirectoryStream *lds = (LinuxDirectoryStream *)path_stream;
-		for (;;) {
-			if (lds->buf_pos >= lds->buf_end) {
-				u64 ret = syscall3(SYS_getdents64, lds->fd, (iptr)lds->buf,
-				                   sizeof(lds->buf));
-				if (ret > -4096UL) {
-					stream_append_s8(&error_stream, s8("os_get_valid_file: SYS_getdents"));
-					die(&error_stream);
-				}
-				if (ret == 0)
-					break;
-				lds->buf_end = ret;
-				lds->buf_pos = 0;
+		if (lds->head_in_use) {
+			ReadAheadSlot *slot = lds->slots + lds->head;
+			if (slot->state == READ_AHEAD_MAPPED) {
+				syscall2(SYS_munmap, (iptr)slot->buf, slot->size);
+				slot->state = READ_AHEAD_SYNC;
 			}
-			u16  record_len = DIRENT_RECLEN(lds->buf + lds->buf_pos);
-			u8   type       = DIRENT_TYPE(lds->buf + lds->buf_pos);
-			char *name      = DIRENT_NAME(lds->buf + lds->buf_pos);
-			lds->buf_pos += record_len;
-			if (type == DT_REGULAR_FILE) {
-				b32 valid = 1;
-				for (size i = 0; i < match_prefix.len; i++) {
-					if (match_prefix.s[i] != name[i]) {
-						valid = 0;
-						break;
-					}
-				}
-				if (valid) {
-					result = os_read_whole_file_at(name, lds->fd, a, arena_flags);
-					break;
-				}
+			lds->head = (lds->head + 1) % READ_AHEAD_DEPTH;
+			lds->count--;
+			lds->head_in_use = 0;
+		}
+
+		linux_queue_reads(lds);
+
+		if (lds->count) {
+			ReadAheadSlot *slot = lds->slots + lds->head;
+			if (slot->state == READ_AHEAD_SYNC) {
+				result = os_read_whole_file_at(slot->name, lds->fd, a, arena_flags);
+			} else {
+				while (slot->state == READ_AHEAD_IN_FLIGHT)
+					linux_io_uring_enter(lds, 1);
+				result = (s8){.len = slot->size, .s = slot->buf};
 			}
+			lds->head_in_use = 1;
+			*name = cstr_to_s8(slot->name);
 		}
 	}
 	return result;
@@ -190,9 +821,12 @@ os_get_valid_file(iptr path_stream, s8 match_prefix, Arena *a, u32 arena_flags)
 void
 linux_main(i32 argc, char *argv[], char *envp[])
 {
-	(void)envp;
+	/* NOTE: the auxiliary vector follows the environment */
+	while (*envp) envp++;
+	for (u64 *auxv = (u64 *)(envp + 1); auxv[0]; auxv += 2)
+		if (auxv[0] == AT_HWCAP) linux_hwcap = auxv[1];
 
-	Arena memory = os_new_arena(1024 * MEGABYTE);
+	Arena memory = arena_new(0, 0);
 
 	error_stream.fd   = 2;
 	error_stream.cap  = 4096;
@@ -202,6 +836,9 @@ linux_main(i32 argc, char *argv[], char *envp[])
 	stdout_stream.cap  = 8 * MEGABYTE;
 	stdout_stream.data = alloc(&memory, u8, stdout_stream.cap, ARENA_NO_CLEAR);
 
+	stdout_stream.iov_cap = STREAM_IOV_MAX;
+	stdout_stream.iov     = alloc(&memory, IOVec, stdout_stream.iov_cap, ARENA_NO_CLEAR);
+
 	i32 result = jdict(&memory, argc, argv);
 
 	os_exit(result);
@@ -10,25 +10,48 @@ typedef signed   long  size;
 typedef unsigned long  usize;
 typedef signed   long  iptr;
 
+#define SYS_inotify_init1      26
+#define SYS_inotify_add_watch  27
+#define SYS_unlinkat           35
 #define SYS_openat             56
 #define SYS_close              57
 #define SYS_getdents64         61
 #define SYS_read               63
 #define SYS_write              64
+#define SYS_writev             66
+#define SYS_ppoll              73
+#define SYS_newfstatat         79
 #define SYS_fstat              80
 #define SYS_exit               93
+#define SYS_getpid            172
+#define SYS_geteuid           175
+#define SYS_munmap            215
+#define SYS_clone             220
 #define SYS_mmap              222
+#define SYS_fadvise64         223
+#define SYS_madvise           233
+#define SYS_wait4             260
+#define SYS_renameat2         276
+#define SYS_io_uring_setup    425
+#define SYS_io_uring_enter    426
 
 /* NOTE(rnp): technically arm64 can have 4K, 16K or 64K pages but we will just assume 64K */
 #define PAGESIZE 65536
 
 #define O_DIRECTORY   0x4000
+#define O_NOFOLLOW    0x8000
+
+#define STAT_MODE(sb) STAT_BUF_MEMBER(sb, u32, 16)
+#define STAT_UID(sb)  STAT_BUF_MEMBER(sb, u32, 24)
+
+#define HWCAP_ASIMD   (1 << 1)
 
 #include "platform_linux.c"
 
 static FORCE_INLINE i64
 syscall1(i64 n, i64 a1)
 {
+	stats.syscalls++;
 	register i64 x8 asm("x8") = n;
 	register i64 x0 asm("x0") = a1;
 	asm volatile ("svc 0"
@@ -42,6 +65,7 @@ syscall1(i64 n, i64 a1)
 static FORCE_INLINE i64
 syscall2(i64 n, i64 a1, i64 a2)
 {
+	stats.syscalls++;
 	register i64 x8 asm("x8") = n;
 	register i64 x0 asm("x0") = a1;
 	register i64 x1 asm("x1") = a2;
@@ -56,6 +80,7 @@ syscall2(i64 n, i64 a1, i64 a2)
 static FORCE_INLINE i64
 syscall3(i64 n, i64 a1, i64 a2, i64 a3)
 {
+	stats.syscalls++;
 	register i64 x8 asm("x8") = n;
 	register i64 x0 asm("x0") = a1;
 	register i64 x1 asm("x1") = a2;
@@ -71,6 +96,7 @@ syscall3(i64 n, i64 a1, i64 a2, i64 a3)
 static FORCE_INLINE i64
 syscall4(i64 n, i64 a1, i64 a2, i64 a3, i64 a4)
 {
+	stats.syscalls++;
 	register i64 x8 asm("x8") = n;
 	register i64 x0 asm("x0") = a1;
 	register i64 x1 asm("x1") = a2;
@@ -84,9 +110,28 @@ syscall4(i64 n, i64 a1, i64 a2, i64 a3, i64 a4)
 	return x0;
 }
 
+static FORCE_INLINE i64
+syscall5(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5)
+{
+	stats.syscalls++;
+	register i64 x8 asm("x8") = n;
+	register i64 x0 asm("x0") = a1;
+	register i64 x1 asm("x1") = a2;
+	register i64 x2 asm("x2") = a3;
+	register i64 x3 asm("x3") = a4;
+	register i64 x4 asm("x4") = a5;
+	asm volatile ("svc 0"
+		: "=r"(x0)
+		: "0"(x0), "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4)
+		: "memory", "cc"
+	);
+	return x0;
+}
+
 static FORCE_INLINE i64
 syscall6(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5, i64 a6)
 {
+	stats.syscalls++;
 	register i64 x8 asm("x8") = n;
 	register i64 x0 asm("x0") = a1;
 	register i64 x1 asm("x1") = a2;
@@ -102,6 +147,28 @@ syscall6(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5, i64 a6)
 	return x0;
 }
 
+static u64
+os_timer(void)
+{
+	u64 result;
+	asm volatile ("mrs %0, cntvct_el0" : "=r"(result));
+	return result;
+}
+
+static u32
+os_cpu_features(void)
+{
+	return linux_hwcap & HWCAP_ASIMD ? CPU_ASIMD : 0;
+}
+
+static u64
+os_timer_frequency(void)
+{
+	u64 result;
+	asm volatile ("mrs %0, cntfrq_el0" : "=r"(result));
+	return result;
+}
+
 asm (
 	".global _start\n"
 	"_start:\n"
@@ -10,24 +10,48 @@ typedef signed   long  size;
 typedef unsigned long  usize;
 typedef signed   long  iptr;
 
-#define SYS_read       0
-#define SYS_write      1
-#define SYS_close      3
-#define SYS_fstat      5
-#define SYS_mmap       9
-#define SYS_exit       60
-#define SYS_getdents64 217
-#define SYS_openat     257
+#define SYS_read            0
+#define SYS_write           1
+#define SYS_close           3
+#define SYS_fstat           5
+#define SYS_mmap            9
+#define SYS_munmap          11
+#define SYS_writev          20
+#define SYS_madvise         28
+#define SYS_getpid          39
+#define SYS_clone           56
+#define SYS_exit            60
+#define SYS_wait4           61
+#define SYS_geteuid         107
+#define SYS_getdents64      217
+#define SYS_fadvise64       221
+#define SYS_clock_gettime   228
+#define SYS_inotify_add_watch 254
+#define SYS_openat          257
+#define SYS_newfstatat      262
+#define SYS_unlinkat        263
+#define SYS_ppoll           271
+#define SYS_inotify_init1   294
+#define SYS_renameat2       316
+#define SYS_io_uring_setup  425
+#define SYS_io_uring_enter  426
 
 #define PAGESIZE 4096
 
+#define CLOCK_MONOTONIC 1
+
 #define O_DIRECTORY   0x10000
+#define O_NOFOLLOW    0x20000
+
+#define STAT_MODE(sb) STAT_BUF_MEMBER(sb, u32, 24)
+#define STAT_UID(sb)  STAT_BUF_MEMBER(sb, u32, 28)
 
 #include "platform_linux.c"
 
 static i64
 syscall1(i64 n, i64 a1)
 {
+	stats.syscalls++;
 	i64 result;
 	asm volatile ("syscall"
 		: "=a"(result)
@@ -40,6 +64,7 @@ syscall1(i64 n, i64 a1)
 static i64
 syscall2(i64 n, i64 a1, i64 a2)
 {
+	stats.syscalls++;
 	i64 result;
 	asm volatile ("syscall"
 		: "=a"(result)
@@ -52,6 +77,7 @@ syscall2(i64 n, i64 a1, i64 a2)
 static i64
 syscall3(i64 n, i64 a1, i64 a2, i64 a3)
 {
+	stats.syscalls++;
 	i64 result;
 	asm volatile ("syscall"
 		: "=a"(result)
@@ -64,6 +90,7 @@ syscall3(i64 n, i64 a1, i64 a2, i64 a3)
 static i64
 syscall4(i64 n, i64 a1, i64 a2, i64 a3, i64 a4)
 {
+	stats.syscalls++;
 	i64 result;
 	register i64 r10 asm("r10") = a4;
 	asm volatile ("syscall"
@@ -74,9 +101,25 @@ syscall4(i64 n, i64 a1, i64 a2, i64 a3, i64 a4)
 	return result;
 }
 
+static i64
+syscall5(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5)
+{
+	stats.syscalls++;
+	i64 result;
+	register i64 r10 asm("r10") = a4;
+	register i64 r8  asm("r8")  = a5;
+	asm volatile ("syscall"
+		: "=a"(result)
+		: "a"(n), "D"(a1), "S"(a2), "d"(a3), "r"(r10), "r"(r8)
+		: "rcx", "r11", "memory"
+	);
+	return result;
+}
+
 static i64
 syscall6(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5, i64 a6)
 {
+	stats.syscalls++;
 	i64 result;
 	register i64 r10 asm("r10") = a4;
 	register i64 r8  asm("r8")  = a5;
@@ -89,6 +132,57 @@ syscall6(i64 n, i64 a1, i64 a2, i64 a3, i64 a4, i64 a5, i64 a6)
 	return result;
 }
 
+static u64
+os_timer(void)
+{
+	u32 lo, hi;
+	asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+	return (u64)hi << 32 | lo;
+}
+
+/* NOTE: wide registers are only usable if the os saves them (XCR0) */
+static u32
+os_cpu_features(void)
+{
+	u32 result = 0, a, b, c, d;
+	asm volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(0), "c"(0));
+	if (a < 7)
+		return result;
+	asm volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(1), "c"(0));
+	if (!(c & (1 << 27)))
+		return result;
+
+	u32 xcr0, xcr0_hi;
+	asm volatile ("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+	asm volatile ("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(7), "c"(0));
+	if ((xcr0 & 0x06) == 0x06 && (b & (1 << 5)))
+		result |= CPU_AVX2;
+	if ((xcr0 & 0xE6) == 0xE6 && (b & (1 << 16)) && (b & (1 << 30)))
+		result |= CPU_AVX512BW;
+	return result;
+}
+
+static u64
+os_clock_ns(void)
+{
+	i64 ts[2];
+	syscall2(SYS_clock_gettime, CLOCK_MONOTONIC, (iptr)ts);
+	return ts[0] * 1000000000ULL + ts[1];
+}
+
+/* NOTE(rnp): the TSC rate isn't exposed to userspace; calibrate it against the
+ * monotonic clock. this is only called when a trace is written */
+static u64
+os_timer_frequency(void)
+{
+	u64 ns_start    = os_clock_ns();
+	u64 timer_start = os_timer();
+	u64 ns_end;
+	do { ns_end = os_clock_ns(); } while (ns_end - ns_start < 10000000ULL);
+	u64 timer_end = os_timer();
+	return (timer_end - timer_start) * 1000000000ULL / (ns_end - ns_start);
+}
+
 asm (
 	".intel_syntax noprefix\n"
 	".global _start\n"
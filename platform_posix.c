@@ -1,8 +1,15 @@
 #define _DEFAULT_SOURCE 1
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <stdint.h>
@@ -22,6 +29,39 @@ typedef ptrdiff_t iptr;
 
 #include "jdict.c"
 
+/* NOTE: linux caps a single read at just under 2GB */
+#define READ_CHUNK_SIZE (1L << 30)
+
+enum read_ahead_state {
+	READ_AHEAD_SYNC,
+	READ_AHEAD_DONE,
+	READ_AHEAD_MAPPED,
+};
+
+typedef struct {
+	u8  *buf;
+	u8  *map;
+	size size;
+	u32  state;
+	char name[256];
+} ReadAheadSlot;
+
+/* NOTE: slots form a queue of upcoming files in directory order. a reader thread
+ * fills them while the head is handed to the caller */
+typedef struct {
+	DIR *dir;
+	s8   match_prefix;
+	pthread_t       thread;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	b32  exhausted;
+	b32  stop;
+	b32  head_in_use;
+	u32  head;
+	u32  count;
+	ReadAheadSlot slots[READ_AHEAD_DEPTH];
+} PosixDirectoryStream;
+
 static void
 os_exit(i32 code)
 {
@@ -34,31 +74,296 @@ os_new_arena(size cap)
 {
 	Arena a;
 
-	size pagesize = sysconf(_SC_PAGESIZE);
-	if (cap % pagesize != 0)
-		cap += pagesize - cap % pagesize;
+	if (cap % HUGEPAGE_SIZE != 0)
+		cap += HUGEPAGE_SIZE - cap % HUGEPAGE_SIZE;
 
-	a.beg = mmap(0, cap, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
-	if (a.beg == MAP_FAILED)
+	/* NOTE: over map so that the arena can start on a huge page boundary */
+	u8 *memory = mmap(0, cap + HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+	                  MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if (memory == MAP_FAILED)
 		return (Arena){0};
+	size slack = -(usize)memory & (HUGEPAGE_SIZE - 1);
+	if (slack)
+		munmap(memory, slack);
+	munmap(memory + slack + cap, HUGEPAGE_SIZE - slack);
+	a.beg = memory + slack;
 	a.end = a.beg + cap;
-#ifdef _DEBUG_ARENA
-	a.min_capacity_remaining = cap;
-#endif
+	a.block = 0;
+	stats.syscalls += 4;
+	#ifdef MADV_HUGEPAGE
+	madvise(a.beg, cap, MADV_HUGEPAGE);
+	stats.syscalls++;
+	#endif
+	stats.arena_capacity += cap;
 	return a;
 }
 
-static b32
+static void
+os_unmap(void *memory, size len)
+{
+	munmap(memory, len);
+	stats.syscalls++;
+}
+
+/* NOTE: mapping fresh anonymous pages over the range is the portable way of
+ * getting zeroed pages back without touching them */
+static void
+os_zero_pages(void *memory, size len)
+{
+	size pagesize = sysconf(_SC_PAGESIZE);
+	u8 *beg = memory, *end = beg + len;
+	u8 *page_beg = (u8 *)(((usize)beg + pagesize - 1) & ~(usize)(pagesize - 1));
+	u8 *page_end = (u8 *)((usize)end & ~(usize)(pagesize - 1));
+	if (page_beg >= page_end) {
+		mem_clear(beg, 0, len);
+		return;
+	}
+	mem_clear(beg, 0, page_beg - beg);
+	if (mmap(page_beg, page_end - page_beg, PROT_READ|PROT_WRITE,
+	         MAP_ANONYMOUS|MAP_PRIVATE|MAP_FIXED, -1, 0) == MAP_FAILED)
+		mem_clear(page_beg, 0, page_end - page_beg);
+	stats.syscalls++;
+	#ifdef MADV_HUGEPAGE
+	madvise(page_beg, page_end - page_beg, MADV_HUGEPAGE);
+	stats.syscalls++;
+	#endif
+	mem_clear(page_end, 0, end - page_end);
+}
+
+static size
 os_read_stdin(u8 *buf, size count)
 {
 	size rlen = read(STDIN_FILENO, buf, count);
-	return rlen == count;
+	stats.syscalls++;
+	if (rlen > 0) stats.bytes_read += rlen;
+	return rlen > 0 ? rlen : 0;
+}
+
+static u64
+os_timer(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64
+os_timer_frequency(void)
+{
+	return 1000000000ULL;
+}
+
+static u32
+os_cpu_features(void)
+{
+	u32 result = 0;
+	#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))     result |= CPU_AVX2;
+	if (__builtin_cpu_supports("avx512bw")) result |= CPU_AVX512BW;
+	#elif defined(__aarch64__)
+	/* NOTE: advanced simd is part of the base architecture */
+	result |= CPU_ASIMD;
+	#endif
+	return result;
+}
+
+static iptr
+os_open_for_write(char *path)
+{
+	stats.syscalls++;
+	return open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+}
+
+static void
+os_close(iptr fd)
+{
+	stats.syscalls++;
+	close(fd);
+}
+
+/* NOTE: reads are chunked since linux caps a single read at just under 2GB */
+static void
+posix_read_all(i32 fd, u8 *buf, size len, char *file)
+{
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, len, POSIX_FADV_SEQUENTIAL);
+	__atomic_fetch_add(&stats.syscalls, 1, __ATOMIC_RELAXED);
+#endif
+	for (size done = 0; done < len;) {
+		size chunk = len - done;
+		if (chunk > READ_CHUNK_SIZE) chunk = READ_CHUNK_SIZE;
+		size rlen = read(fd, buf + done, chunk);
+		__atomic_fetch_add(&stats.syscalls, 1, __ATOMIC_RELAXED);
+		if (rlen < 0 && errno == EINTR)
+			continue;
+		if (rlen <= 0) {
+			stream_append_s8(&error_stream, s8("failed to read whole file: "));
+			stream_append_s8(&error_stream, cstr_to_s8(file));
+			die(&error_stream);
+		}
+		__atomic_fetch_add(&stats.bytes_read, rlen, __ATOMIC_RELAXED);
+		done += rlen;
+	}
 }
 
 static s8
-os_read_whole_file_at(char *file, iptr dir_fd, Arena *a, u32 arena_flags)
+posix_map_file(char *path, b32 private)
+{
+	s8 result = {0};
+	i32 fd = open(path, O_RDONLY|(private ? O_NOFOLLOW : 0));
+	if (fd < 0)
+		return result;
+
+	struct stat st;
+	b32 ok = fstat(fd, &st) == 0;
+	if (ok && private)
+		ok = S_ISREG(st.st_mode) && !(st.st_mode & (S_IWGRP|S_IWOTH)) &&
+		     st.st_uid == geteuid();
+	if (ok && st.st_size > 0) {
+		void *map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			result.s   = map;
+			result.len = st.st_size;
+		}
+	}
+	close(fd);
+	stats.syscalls += 4;
+	return result;
+}
+
+static s8
+os_map_file(char *path)
+{
+	return posix_map_file(path, 0);
+}
+
+/* NOTE: only maps a regular file owned by the user that no one else can
+ * write to; for files found in directories shared with other users */
+static s8
+os_map_private_file(char *path)
+{
+	return posix_map_file(path, 1);
+}
+
+/* NOTE: data is written to a temporary file and renamed into place so that
+ * readers only ever see complete files. the temporary file must be new so
+ * that no one else can have it open */
+static b32
+os_publish_file(char *path, s8 data)
+{
+	u8 tmp_path[4096];
+	Stream tmp = {.data = tmp_path, .cap = sizeof(tmp_path)};
+	stream_append_s8(&tmp, cstr_to_s8(path));
+	stream_append_s8(&tmp, s8(".tmp."));
+	stream_append_u64(&tmp, getpid());
+	stream_append_byte(&tmp, 0);
+	if (tmp.errors)
+		return 0;
+
+	iptr fd = open((char *)tmp_path, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW, 0644);
+	stats.syscalls++;
+	if (fd < 0)
+		return 0;
+	b32 result = os_write(fd, data);
+	os_close(fd);
+
+	if (result) result = rename((char *)tmp_path, path) == 0;
+	if (!result) unlink((char *)tmp_path);
+	stats.syscalls += 2;
+
+	return result;
+}
+
+/* order independent hash of the name, size and mtime of each matching file */
+static u64
+os_dir_fingerprint(char *path, s8 match_prefix)
+{
+	DIR *dir = opendir(path);
+	if (!dir) {
+		/* NOTE: not a directory; fingerprint the archive itself */
+		struct stat st;
+		if (stat(path, &st) != 0)
+			return 0;
+		u64 h = (u64)st.st_size * 1111111111111111111;
+		h = (h ^ (u64)st.st_mtim.tv_sec)  * 1111111111111111111;
+		h = (h ^ (u64)st.st_mtim.tv_nsec) * 1111111111111111111;
+		return h;
+	}
+
+	u64 result = 0;
+	struct dirent *dent;
+	while ((dent = readdir(dir)) != NULL) {
+		s8 name = cstr_to_s8(dent->d_name);
+		if (dent->d_type != DT_REG || name.len < match_prefix.len ||
+		    !s8_equal((s8){.len = match_prefix.len, .s = name.s}, match_prefix))
+			continue;
+
+		struct stat st;
+		if (fstatat(dirfd(dir), dent->d_name, &st, 0) != 0)
+			continue;
+		stats.syscalls++;
+		u64 h = hash(name);
+		h = (h ^ (u64)st.st_size)         * 1111111111111111111;
+		h = (h ^ (u64)st.st_mtim.tv_sec)  * 1111111111111111111;
+		h = (h ^ (u64)st.st_mtim.tv_nsec) * 1111111111111111111;
+		result += h;
+	}
+	closedir(dir);
+	stats.syscalls += 2;
+
+	return result;
+}
+
+/* NOTE: there is no portable change notification; the repl polls instead */
+static iptr
+os_watch_new(void)
+{
+	return -1;
+}
+
+static void
+os_watch_path(iptr watch, char *path)
+{
+	(void)watch;
+	(void)path;
+}
+
+static u32
+os_wait_for_input(iptr watch, i32 timeout_ms)
+{
+	(void)watch;
+	struct pollfd fd = {.fd = STDIN_FILENO, .events = POLLIN};
+	i32 ready = poll(&fd, 1, timeout_ms);
+	stats.syscalls++;
+	if (ready < 0 && errno == EINTR)
+		return 0;
+	return ready ? OS_INPUT_READY : 0;
+}
+
+static iptr
+os_fork(void)
+{
+	stats.syscalls++;
+	return fork();
+}
+
+static b32
+os_child_done(iptr pid, b32 *ok)
 {
+	i32 status = 0;
+	pid_t result = waitpid(pid, &status, WNOHANG);
+	stats.syscalls++;
+	if (result == 0)
+		return 0;
+	*ok = result == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	return 1;
+}
 
+static s8
+os_read_whole_file_at(char *file, iptr dir_fd, Arena *a, u32 arena_flags)
+{
+	TraceZone zone = trace_begin(s8("os_read_whole_file_at"), cstr_to_s8(file));
 	i32 fd = openat(dir_fd, file, O_RDONLY);
 	if (fd < 0) {
 		stream_append_s8(&error_stream, s8("failed to open: "));
@@ -74,14 +379,10 @@ os_read_whole_file_at(char *file, iptr dir_fd, Arena *a, u32 arena_flags)
 	}
 
 	s8 result = {.len = st.st_size, .s = alloc(a, u8, st.st_size, arena_flags|ARENA_NO_CLEAR)};
-	size rlen = read(fd, result.s, result.len);
+	posix_read_all(fd, result.s, result.len, file);
 	close(fd);
-
-	if (rlen != result.len) {
-		stream_append_s8(&error_stream, s8("failed to read whole file: "));
-		stream_append_s8(&error_stream, cstr_to_s8(file));
-		die(&error_stream);
-	}
+	stats.syscalls += 3;
+	trace_end(zone);
 
 	return result;
 }
@@ -91,49 +392,181 @@ os_write(iptr file, s8 raw)
 {
 	while (raw.len) {
 		size r = write(file, raw.s, raw.len);
+		stats.syscalls++;
 		if (r < 0) return 0;
 		raw = s8_cut_head(raw, r);
 	}
 	return 1;
 }
 
-static iptr
-os_begin_path_stream(Stream *dir_name, Arena *a, u32 arena_flags)
+static b32
+os_writev(iptr file, IOVec *iov, u32 count)
 {
-	(void)a; (void)arena_flags;
+	while (count) {
+		size r = writev(file, (struct iovec *)iov, count);
+		stats.syscalls++;
+		if (r < 0) return 0;
+		/* NOTE: on a short write skip what was written and go again */
+		for (; count && r >= (size)iov->len; count--, iov++)
+			r -= iov->len;
+		if (count) {
+			iov->base = (u8 *)iov->base + r;
+			iov->len -= r;
+		}
+	}
+	return 1;
+}
 
+static void
+posix_read_into_slot(PosixDirectoryStream *pds, ReadAheadSlot *slot)
+{
+	i32 fd = openat(dirfd(pds->dir), slot->name, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		stream_append_s8(&error_stream, s8("failed to open: "));
+		stream_append_s8(&error_stream, cstr_to_s8(slot->name));
+		die(&error_stream);
+	}
+	__atomic_fetch_add(&stats.syscalls, 2, __ATOMIC_RELAXED);
+
+	if (use_mmap_reads && st.st_size > 0) {
+		void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, st.st_size, POSIX_MADV_WILLNEED);
+			slot->map   = map;
+			slot->size  = st.st_size;
+			slot->state = READ_AHEAD_MAPPED;
+			__atomic_fetch_add(&stats.bytes_read, st.st_size, __ATOMIC_RELAXED);
+		}
+	} else if (st.st_size > 0 && st.st_size <= (size)READ_AHEAD_SLOT_SIZE) {
+		TraceZone zone = trace_begin(s8("read ahead"), cstr_to_s8(slot->name));
+		zone.tid = 1;
+		posix_read_all(fd, slot->buf, st.st_size, slot->name);
+		slot->size  = st.st_size;
+		slot->state = READ_AHEAD_DONE;
+		trace_end(zone);
+	}
+	close(fd);
+	__atomic_fetch_add(&stats.syscalls, 1, __ATOMIC_RELAXED);
+}
+
+/* NOTE: fills slots in directory order while the main thread parses the head */
+static void *
+posix_read_ahead_thread(void *arg)
+{
+	PosixDirectoryStream *pds = arg;
+	u32 tail = 0;
+	struct dirent *dent;
+	while ((dent = readdir(pds->dir)) != NULL) {
+		if (dent->d_type != DT_REG)
+			continue;
+		b32 valid = 1;
+		for (size i = 0; i < pds->match_prefix.len; i++) {
+			if (pds->match_prefix.s[i] != dent->d_name[i]) {
+				valid = 0;
+				break;
+			}
+		}
+		if (!valid)
+			continue;
+
+		pthread_mutex_lock(&pds->lock);
+		while (pds->count == READ_AHEAD_DEPTH && !pds->stop)
+			pthread_cond_wait(&pds->cond, &pds->lock);
+		b32 stop = pds->stop;
+		pthread_mutex_unlock(&pds->lock);
+		if (stop)
+			break;
+
+		ReadAheadSlot *slot = pds->slots + tail;
+		tail = (tail + 1) % READ_AHEAD_DEPTH;
+		u32 i;
+		for (i = 0; dent->d_name[i] && i < sizeof(slot->name) - 1; i++)
+			slot->name[i] = dent->d_name[i];
+		slot->name[i] = 0;
+		slot->state   = READ_AHEAD_SYNC;
+		posix_read_into_slot(pds, slot);
+
+		pthread_mutex_lock(&pds->lock);
+		pds->count++;
+		pthread_cond_signal(&pds->cond);
+		pthread_mutex_unlock(&pds->lock);
+	}
+
+	pthread_mutex_lock(&pds->lock);
+	pds->exhausted = 1;
+	pthread_cond_signal(&pds->cond);
+	pthread_mutex_unlock(&pds->lock);
+
+	return 0;
+}
+
+static iptr
+os_begin_path_stream(Stream *dir_name, s8 match_prefix, Arena *a, u32 arena_flags)
+{
 	stream_append_byte(dir_name, 0);
 	DIR *dir = opendir((char *)dir_name->data);
+	stats.syscalls++;
 	if (!dir) {
 		stream_append_s8(&error_stream, s8("opendir: failed to open: "));
 		stream_append_s8(&error_stream, (s8){.len = dir_name->widx - 1, .s = dir_name->data});
 		die(&error_stream);
 	}
-	return (iptr)dir;
+
+	PosixDirectoryStream *pds = alloc(a, PosixDirectoryStream, 1, arena_flags);
+	pds->dir          = dir;
+	pds->match_prefix = match_prefix;
+	if (!use_mmap_reads) {
+		for (u32 i = 0; i < READ_AHEAD_DEPTH; i++)
+			pds->slots[i].buf = alloc(a, u8, READ_AHEAD_SLOT_SIZE, arena_flags|ARENA_NO_CLEAR);
+	}
+	pthread_mutex_init(&pds->lock, 0);
+	pthread_cond_init(&pds->cond, 0);
+
+	if (pthread_create(&pds->thread, 0, posix_read_ahead_thread, pds)) {
+		stream_append_s8(&error_stream, s8("os_begin_path_stream: failed to start reader thread"));
+		die(&error_stream);
+	}
+
+	return (iptr)pds;
 }
 
+/* NOTE: name is set to the name of the returned file which stays valid until
+ * the next call */
 static s8
-os_get_valid_file(iptr path_stream, s8 match_prefix, Arena *a, u32 arena_flags)
+os_get_valid_file(iptr path_stream, Arena *a, u32 arena_flags, s8 *name)
 {
 	s8 result = {0};
 	if (path_stream) {
-		DIR *dir    = (DIR *)path_stream;
-		iptr dir_fd = dirfd(dir);
-		struct dirent *dent;
-		while ((dent = readdir(dir)) != NULL) {
-			if (dent->d_type == DT_REG) {
-				b32 valid = 1;
-				for (size i = 0; i < match_prefix.len; i++) {
-					if (match_prefix.s[i] != dent->d_name[i]) {
-						valid = 0;
-						break;
-					}
-				}
-				if (valid) {
-					result = os_read_whole_file_at(dent->d_name, dir_fd, a, arena_flags);
-					break;
-				}
+		PosixDirectoryStream *pds = (PosixDirectoryStream *)path_stream;
+
+		pthread_mutex_lock(&pds->lock);
+		if (pds->head_in_use) {
+			ReadAheadSlot *slot = pds->slots + pds->head;
+			if (slot->state == READ_AHEAD_MAPPED) {
+				munmap(slot->map, slot->size);
+				slot->state = READ_AHEAD_SYNC;
 			}
+			pds->head = (pds->head + 1) % READ_AHEAD_DEPTH;
+			pds->count--;
+			pds->head_in_use = 0;
+			pthread_cond_signal(&pds->cond);
+		}
+		while (!pds->count && !pds->exhausted)
+			pthread_cond_wait(&pds->cond, &pds->lock);
+		u32 count = pds->count;
+		pthread_mutex_unlock(&pds->lock);
+
+		if (count) {
+			ReadAheadSlot *slot = pds->slots + pds->head;
+			if (slot->state == READ_AHEAD_SYNC)
+				result = os_read_whole_file_at(slot->name, dirfd(pds->dir), a, arena_flags);
+			else if (slot->state == READ_AHEAD_MAPPED)
+				result = (s8){.len = slot->size, .s = slot->map};
+			else
+				result = (s8){.len = slot->size, .s = slot->buf};
+			pds->head_in_use = 1;
+			*name = cstr_to_s8(slot->name);
 		}
 	}
 	return result;
@@ -142,13 +575,28 @@ os_get_valid_file(iptr path_stream, s8 match_prefix, Arena *a, u32 arena_flags)
 static void
 os_end_path_stream(iptr path_stream)
 {
-	closedir((DIR *)path_stream);
+	PosixDirectoryStream *pds = (PosixDirectoryStream *)path_stream;
+
+	pthread_mutex_lock(&pds->lock);
+	pds->stop = 1;
+	pthread_cond_signal(&pds->cond);
+	pthread_mutex_unlock(&pds->lock);
+	pthread_join(pds->thread, 0);
+
+	for (u32 i = 0; i < READ_AHEAD_DEPTH; i++)
+		if (pds->slots[i].state == READ_AHEAD_MAPPED)
+			munmap(pds->slots[i].map, pds->slots[i].size);
+
+	pthread_mutex_destroy(&pds->lock);
+	pthread_cond_destroy(&pds->cond);
+	closedir(pds->dir);
+	stats.syscalls++;
 }
 
 i32
 main(i32 argc, char *argv[])
 {
-	Arena memory = os_new_arena(1024 * MEGABYTE);
+	Arena memory = arena_new(0, 0);
 
 	error_stream.fd   = STDERR_FILENO;
 	error_stream.cap  = 4096;
@@ -158,5 +606,8 @@ main(i32 argc, char *argv[])
 	stdout_stream.cap  = 8 * MEGABYTE;
 	stdout_stream.data = alloc(&memory, u8, stdout_stream.cap, ARENA_NO_CLEAR);
 
+	stdout_stream.iov_cap = STREAM_IOV_MAX;
+	stdout_stream.iov     = alloc(&memory, IOVec, stdout_stream.iov_cap, ARENA_NO_CLEAR);
+
 	return jdict(&memory, argc, argv);
 }
@@ -0,0 +1,158 @@
+/* See LICENSE for license details.
+ *
+ * simd.c implements the byte kernels used while lexing term banks,
+ * copying definitions and escaping JSON output in variants for
+ * several vector widths.
+ * The program is built for the base instruction set of its target
+ * and simd_init() picks the widest variant the running cpu supports
+ * from the features reported by the platform layer.
+ */
+
+enum cpu_features {
+	CPU_AVX2     = 1 << 0,
+	CPU_AVX512BW = 1 << 1,
+	CPU_ASIMD    = 1 << 2,
+};
+
+typedef struct {
+	size (*scan2)(u8 *, size, u8, u8);
+	void (*copy)(u8 *, u8 *, size);
+	size (*json_span)(u8 *, size);
+	u32   width;
+} SimdKernels;
+
+static size
+simd_scan2_scalar(u8 *s, size len, u8 a, u8 b)
+{
+	size i = 0;
+	for (; i < len && s[i] != a && s[i] != b; i++);
+	return i;
+}
+
+/* NOTE: length of the prefix of s that can be written in a JSON string as is */
+static size
+simd_json_span_scalar(u8 *s, size len)
+{
+	size i = 0;
+	for (; i < len && s[i] >= 0x20 && s[i] != '"' && s[i] != '\\'; i++);
+	return i;
+}
+
+static void
+simd_copy_scalar(u8 *dst, u8 *src, size len)
+{
+	for (size i = 0; i < len; i++)
+		dst[i] = src[i];
+}
+
+/* NOTE: the variants only differ in vector type, target and how a comparison
+ * is turned into a bit mask with one bit per byte */
+#define SIMD_SCAN2(name, vec, attr, mask)                                         \
+static attr size                                                                 \
+name(u8 *s, size len, u8 a, u8 b)                                                \
+{                                                                                \
+	size i = 0;                                                              \
+	for (; i + (size)sizeof(vec) <= len; i += sizeof(vec)) {                 \
+		vec v;                                                           \
+		__builtin_memcpy(&v, s + i, sizeof(v));                          \
+		u64 m = mask((vec)((v == a) | (v == b)));                        \
+		if (m) return i + __builtin_ctzll(m);                            \
+	}                                                                        \
+	return i + simd_scan2_scalar(s + i, len - i, a, b);                      \
+}
+
+/* NOTE: v >> 5 is 0 only for control characters whether bytes are signed or not */
+#define SIMD_JSON_SPAN(name, vec, attr, mask)                                     \
+static attr size                                                                 \
+name(u8 *s, size len)                                                            \
+{                                                                                \
+	size i = 0;                                                              \
+	for (; i + (size)sizeof(vec) <= len; i += sizeof(vec)) {                 \
+		vec v;                                                           \
+		__builtin_memcpy(&v, s + i, sizeof(v));                          \
+		vec e = (vec)((v == '"') | (v == '\\'));                        \
+		u64 m = mask((vec)(e | (vec)((v >> 5) == 0)));                  \
+		if (m) return i + __builtin_ctzll(m);                            \
+	}                                                                        \
+	return i + simd_json_span_scalar(s + i, len - i);                        \
+}
+
+#define SIMD_COPY(name, vec, attr)                                                \
+static attr void                                                                 \
+name(u8 *dst, u8 *src, size len)                                                 \
+{                                                                                \
+	size i = 0;                                                              \
+	for (; i + (size)sizeof(vec) <= len; i += sizeof(vec)) {                 \
+		vec v;                                                           \
+		__builtin_memcpy(&v, src + i, sizeof(v));                        \
+		__builtin_memcpy(dst + i, &v, sizeof(v));                        \
+	}                                                                        \
+	simd_copy_scalar(dst + i, src + i, len - i);                             \
+}
+
+#ifdef __x86_64__
+typedef char i8x16 __attribute__((vector_size(16)));
+typedef char i8x32 __attribute__((vector_size(32)));
+typedef char i8x64 __attribute__((vector_size(64)));
+
+#define SIMD_MASK16(m) (u64)(u32)__builtin_ia32_pmovmskb128(m)
+#define SIMD_MASK32(m) (u64)(u32)__builtin_ia32_pmovmskb256(m)
+#define SIMD_MASK64(m) (SIMD_MASK32(__builtin_shufflevector(m, m, SIMD_LO32)) | \
+                        SIMD_MASK32(__builtin_shufflevector(m, m, SIMD_HI32)) << 32)
+#define SIMD_LO32 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15, \
+                  16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+#define SIMD_HI32 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, \
+                  48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63
+
+#define SIMD_AVX2   __attribute__((target("avx2")))
+#define SIMD_AVX512 __attribute__((target("avx512bw")))
+
+SIMD_SCAN2(simd_scan2_sse2,   i8x16,            , SIMD_MASK16)
+SIMD_SCAN2(simd_scan2_avx2,   i8x32, SIMD_AVX2,   SIMD_MASK32)
+SIMD_SCAN2(simd_scan2_avx512, i8x64, SIMD_AVX512, SIMD_MASK64)
+SIMD_COPY(simd_copy_sse2,     i8x16, )
+SIMD_COPY(simd_copy_avx2,     i8x32, SIMD_AVX2)
+SIMD_COPY(simd_copy_avx512,   i8x64, SIMD_AVX512)
+SIMD_JSON_SPAN(simd_json_span_sse2,   i8x16,            , SIMD_MASK16)
+SIMD_JSON_SPAN(simd_json_span_avx2,   i8x32, SIMD_AVX2,   SIMD_MASK32)
+SIMD_JSON_SPAN(simd_json_span_avx512, i8x64, SIMD_AVX512, SIMD_MASK64)
+
+static SimdKernels simd = {simd_scan2_sse2, simd_copy_sse2, simd_json_span_sse2, 16};
+
+static void
+simd_init(u32 features)
+{
+	if (features & CPU_AVX512BW)
+		simd = (SimdKernels){simd_scan2_avx512, simd_copy_avx512, simd_json_span_avx512, 64};
+	else if (features & CPU_AVX2)
+		simd = (SimdKernels){simd_scan2_avx2, simd_copy_avx2, simd_json_span_avx2, 32};
+}
+#else
+typedef u8  u8x16  __attribute__((vector_size(16)));
+typedef u64 u64x2  __attribute__((vector_size(16)));
+
+/* NOTE: there is no byte mask instruction; the multiply gathers the low bit
+ * of each byte of a word into its top byte */
+static FORCE_INLINE u64
+simd_mask_asimd(u8x16 m)
+{
+	u64x2 w = (u64x2)m;
+	u64 lo  = w[0] & 0x0101010101010101ULL, hi = w[1] & 0x0101010101010101ULL;
+	lo = (lo * 0x0102040810204080ULL) >> 56;
+	hi = (hi * 0x0102040810204080ULL) >> 56;
+	return lo | hi << 8;
+}
+
+SIMD_SCAN2(simd_scan2_asimd, u8x16, , simd_mask_asimd)
+SIMD_COPY(simd_copy_asimd,   u8x16, )
+SIMD_JSON_SPAN(simd_json_span_asimd, u8x16, , simd_mask_asimd)
+
+static SimdKernels simd = {simd_scan2_scalar, simd_copy_scalar, simd_json_span_scalar, 1};
+
+static void
+simd_init(u32 features)
+{
+	if (features & CPU_ASIMD)
+		simd = (SimdKernels){simd_scan2_asimd, simd_copy_asimd, simd_json_span_asimd, 16};
+}
+#endif
@@ -0,0 +1,157 @@
+/* See LICENSE for license details.
+ *
+ * suffix.c implements suffix array construction with SA-IS (Nong,
+ * Zhang and Chan) and the binary search used to find the range of
+ * suffixes starting with a pattern. Construction runs in linear time
+ * in a caller provided workspace of SUFFIX_WORK_SIZE(n) bytes.
+ */
+
+#define SUFFIX_WORK_SIZE(n) (16 * (size)(n) + 4096)
+
+/* NOTE: with end set bkt[c] is one past the last slot of bucket c otherwise
+ * it is the first slot */
+static void
+sais_buckets(i32 *s, i32 n, i32 k, i32 *bkt, b32 end)
+{
+	for (i32 i = 0; i < k; i++) bkt[i] = 0;
+	for (i32 i = 0; i < n; i++) bkt[s[i]]++;
+	for (i32 i = 0, sum = 0; i < k; i++) {
+		sum += bkt[i];
+		bkt[i] = end ? sum : sum - bkt[i];
+	}
+}
+
+/* NOTE: t[i] is set when suffix i is S-type (smaller than suffix i + 1) */
+static void
+sais_induce(i32 *s, u8 *t, i32 *sa, i32 n, i32 k, i32 *bkt)
+{
+	sais_buckets(s, n, k, bkt, 0);
+	for (i32 i = 0; i < n; i++) {
+		i32 j = sa[i] - 1;
+		if (j >= 0 && !t[j]) sa[bkt[s[j]]++] = j;
+	}
+	sais_buckets(s, n, k, bkt, 1);
+	for (i32 i = n - 1; i >= 0; i--) {
+		i32 j = sa[i] - 1;
+		if (j >= 0 && t[j]) sa[--bkt[s[j]]] = j;
+	}
+}
+
+#define SAIS_IS_LMS(t, i) ((i) > 0 && (t)[i] && !(t)[(i) - 1])
+
+/* s holds n symbols in [0, k) and must end with a unique 0; the type and
+ * bucket arrays of each level are carved from work */
+static void
+sais(i32 *s, i32 *sa, i32 n, i32 k, u8 *work)
+{
+	i32 *bkt = (i32 *)work;
+	u8  *t   = work + k * sizeof(*bkt);
+	work     = t + ((n + 3) & ~3);
+
+	t[n - 1] = 1;
+	for (i32 i = n - 2; i >= 0; i--)
+		t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+
+	/* NOTE: sort the LMS substrings by inducing from their unsorted order */
+	sais_buckets(s, n, k, bkt, 1);
+	for (i32 i = 0; i < n; i++) sa[i] = -1;
+	for (i32 i = 1; i < n; i++)
+		if (SAIS_IS_LMS(t, i)) sa[--bkt[s[i]]] = i;
+	sais_induce(s, t, sa, n, k, bkt);
+
+	i32 n1 = 0;
+	for (i32 i = 0; i < n; i++)
+		if (SAIS_IS_LMS(t, sa[i])) sa[n1++] = sa[i];
+
+	/* NOTE: name the sorted LMS substrings; equal substrings share a name */
+	for (i32 i = n1; i < n; i++) sa[i] = -1;
+	i32 name = 0, prev = -1;
+	for (i32 i = 0; i < n1; i++) {
+		i32 pos  = sa[i];
+		b32 diff = 0;
+		for (i32 d = 0; d < n; d++) {
+			if (prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d]) {
+				diff = 1;
+				break;
+			} else if (d > 0 && (SAIS_IS_LMS(t, pos + d) || SAIS_IS_LMS(t, prev + d))) {
+				break;
+			}
+		}
+		if (diff) {
+			name++;
+			prev = pos;
+		}
+		sa[n1 + pos / 2] = name - 1;
+	}
+	for (i32 i = n - 1, j = n - 1; i >= n1; i--)
+		if (sa[i] >= 0) sa[j--] = sa[i];
+
+	/* NOTE: the reduced string only needs recursion when names repeat */
+	i32 *s1 = sa + n - n1, *sa1 = sa;
+	if (name < n1) sais(s1, sa1, n1, name, work);
+	else           for (i32 i = 0; i < n1; i++) sa1[s1[i]] = i;
+
+	/* NOTE: place the LMS suffixes in their final order and induce the rest */
+	sais_buckets(s, n, k, bkt, 1);
+	for (i32 i = 1, j = 0; i < n; i++)
+		if (SAIS_IS_LMS(t, i)) s1[j++] = i;
+	for (i32 i = 0; i < n1; i++) sa1[i] = s1[sa1[i]];
+	for (i32 i = n1; i < n; i++) sa[i] = -1;
+	for (i32 i = n1 - 1; i >= 0; i--) {
+		i32 j = sa[i];
+		sa[i] = -1;
+		sa[--bkt[s[j]]] = j;
+	}
+	sais_induce(s, t, sa, n, k, bkt);
+}
+
+/* fills sa with the n suffixes of text in sorted order; a suffix that is a
+ * prefix of another sorts first */
+static void
+suffix_array(i32 *sa, u8 *text, i32 n, u8 *work)
+{
+	/* NOTE: shift bytes up by one to make room for the sentinel */
+	i32 *s    = (i32 *)work;
+	i32 *full = s + n + 1;
+	for (i32 i = 0; i < n; i++)
+		s[i] = text[i] + 1;
+	s[n] = 0;
+
+	sais(s, full, n + 1, 257, (u8 *)(full + n + 1));
+
+	/* NOTE: full[0] is the sentinel */
+	for (i32 i = 0; i < n; i++)
+		sa[i] = full[i + 1];
+}
+
+/* NOTE: 0 when pattern is a prefix of the suffix at p */
+static i32
+suffix_compare(u8 *text, i32 n, i32 p, s8 pattern)
+{
+	i32 len = MIN(n - p, pattern.len);
+	for (i32 i = 0; i < len; i++)
+		if (text[p + i] != pattern.s[i])
+			return text[p + i] - pattern.s[i];
+	return len < pattern.len ? -1 : 0;
+}
+
+/* sets [*lo, *hi) to the range of sa whose suffixes start with pattern */
+static void
+suffix_range(u8 *text, i32 *sa, i32 n, s8 pattern, i32 *lo, i32 *hi)
+{
+	i32 l = 0, r = n;
+	while (l < r) {
+		i32 m = l + (r - l) / 2;
+		if (suffix_compare(text, n, sa[m], pattern) < 0) l = m + 1;
+		else                                             r = m;
+	}
+	*lo = l;
+
+	r = n;
+	while (l < r) {
+		i32 m = l + (r - l) / 2;
+		if (suffix_compare(text, n, sa[m], pattern) <= 0) l = m + 1;
+		else                                              r = m;
+	}
+	*hi = l;
+}
@@ -15,7 +15,8 @@ typedef enum {
 	YOMI_ENTRY = 1,
 	YOMI_ARRAY = 2,
 	YOMI_STR = 4,
-	YOMI_NUM = 8
+	YOMI_NUM = 8,
+	YOMI_OBJ = 16
 } YomiType;
 
 typedef struct {
@@ -73,23 +74,57 @@ string(YomiScanner *s, YomiTok *t)
 	const char *d = s->data;
 	ul start = s->pos++;
 
-	for (; s->pos < s->len; s->pos++) {
-		/* skip over escaped " */
-		if (d[s->pos] == '\\' && s->pos + 1 < s->len && d[s->pos + 1] == '\"') {
-			s->pos++;
+	while (s->pos < s->len) {
+		/* NOTE: jump straight to the next quote or escape */
+		s->pos += simd.scan2((u8 *)d + s->pos, s->len - s->pos, '\"', '\\');
+		if (s->pos >= s->len)
+			break;
+
+		/* skip over escaped chars (including \\ and \") */
+		if (d[s->pos] == '\\') {
+			s->pos += 2;
 			continue;
 		}
 
 		/* end of str */
-		if (d[s->pos] == '\"') {
-			t->start = start + 1;
-			t->end = s->pos;
+		t->start = start + 1;
+		t->end = s->pos;
+		t->parent = s->parent;
+		t->type = YOMI_STR;
+		return 0;
+	}
+
+	s->pos = start;
+	return YOMI_ERROR_MALFO;
+}
+
+/* NOTE: objects (structured content and meta bank values) are not looked
+ * into; the token spans the whole object */
+static int
+object(YomiScanner *s, YomiTok *t)
+{
+	const char *d = s->data;
+	ul start = s->pos, depth = 0;
+
+	for (; s->pos < s->len; s->pos++) {
+		switch (d[s->pos]) {
+		case '{':
+			depth++;
+			break;
+		case '}':
+			if (--depth)
+				break;
+			t->start = start;
+			t->end = s->pos + 1;
 			t->parent = s->parent;
-			t->type = YOMI_STR;
+			t->type = YOMI_OBJ;
 			return 0;
+		case '\"':
+			for (s->pos++; s->pos < s->len && d[s->pos] != '\"'; s->pos++)
+				if (d[s->pos] == '\\') s->pos++;
+			break;
 		}
 	}
-
 	s->pos = start;
 	return YOMI_ERROR_MALFO;
 }
@@ -115,7 +150,9 @@ number(YomiScanner *s, YomiTok *t)
 			s->pos--;
 			return 0;
 		}
-		if (!ISDIGIT(d[s->pos])) {
+		/* NOTE: scores can be negative */
+		if (!ISDIGIT(d[s->pos]) && d[s->pos] != '.' &&
+		    !(d[s->pos] == '-' && s->pos == start)) {
 			s->pos = start;
 			return YOMI_ERROR_INVAL;
 		}
@@ -207,7 +244,8 @@ yomi_scan(YomiScanner *s, YomiTok *toks, ul ntoks)
 			if (!tok)
 				return YOMI_ERROR_NOMEM;
 
-			r = number(s, tok);
+			if (s->data[s->pos] == '{') r = object(s, tok);
+			else                        r = number(s, tok);
 			if (r != 0)
 				return r;
 
@@ -0,0 +1,367 @@
+/* See LICENSE for license details.
+ *
+ * yomigen.c writes synthetic yomichan term banks for benchmarking
+ * jdict. The output is deterministic for a given set of options so
+ * that numbers measured on different machines can be compared
+ * without shipping (copyrighted) real dictionaries.
+ *
+ * each entry has the layout:
+ *   [term, reading, tags, rules, score, [glossary...], seq, termtags]
+ *
+ * in addition to the banks a queries.txt file is written containing
+ * every generated term, one per line, which can be fed to jdict.
+ */
+#define _DEFAULT_SOURCE 1
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdint.h>
+#include <stddef.h>
+typedef uint8_t   u8;
+typedef int64_t   i64;
+typedef uint64_t  u64;
+typedef int32_t   i32;
+typedef uint32_t  u32;
+typedef uint32_t  b32;
+typedef ptrdiff_t size;
+
+#define ARRAY_COUNT(a) (sizeof(a) / sizeof(*a))
+
+typedef struct {
+	size len;
+	u8   *s;
+} s8;
+#define s8(cstr) (s8){.len = ARRAY_COUNT(cstr) - 1, .s = (u8 *)cstr}
+
+typedef struct {
+	u8   data[1 << 16];
+	u32  widx;
+	i32  fd;
+	b32  errors;
+} Stream;
+
+typedef struct {
+	u32 min, max;
+} Range;
+
+typedef struct {
+	u64   entries;
+	u32   banks;
+	Range term_chars;
+	Range glossary_count;
+	Range glossary_chars;
+	u32   escape_permille;
+	u64   seed;
+	char *outdir;
+} Options;
+
+static Stream error_stream = {.fd = STDERR_FILENO};
+
+static s8 tag_table[]  = {s8(""), s8("n"), s8("vs"), s8("adj-na"), s8("exp"), s8("P")};
+static s8 rule_table[] = {s8(""), s8("v1"), s8("v5"), s8("vs"), s8("adj-i"), s8("vk")};
+static s8 esc_table[]  = {s8("\\n"), s8("\\t"), s8("\\\""), s8("\\\\")};
+
+static void
+stream_flush(Stream *s)
+{
+	u8 *p = s->data;
+	while (s->widx && !s->errors) {
+		ssize_t r = write(s->fd, p, s->widx);
+		if (r < 0) s->errors = 1;
+		else       { p += r; s->widx -= r; }
+	}
+}
+
+static void
+stream_append_s8(Stream *s, s8 str)
+{
+	for (size i = 0; i < str.len; i++) {
+		if (s->widx == sizeof(s->data))
+			stream_flush(s);
+		s->data[s->widx++] = str.s[i];
+	}
+}
+
+static void
+stream_append_byte(Stream *s, u8 b)
+{
+	stream_append_s8(s, (s8){.len = 1, .s = &b});
+}
+
+static void
+stream_append_i64(Stream *s, i64 n)
+{
+	u8 tmp[32];
+	u8 *end = tmp + sizeof(tmp);
+	u8 *beg = end;
+	u64 v   = n < 0 ? -(u64)n : (u64)n;
+	do { *--beg = '0' + (v % 10); } while (v /= 10);
+	if (n < 0) *--beg = '-';
+	stream_append_s8(s, (s8){.len = end - beg, .s = beg});
+}
+
+static void
+stream_append_codepoint(Stream *s, u32 cp)
+{
+	u8 buf[3];
+	if (cp < 0x80) {
+		stream_append_byte(s, cp);
+	} else if (cp < 0x800) {
+		buf[0] = 0xC0 | (cp >> 6);
+		buf[1] = 0x80 | (cp & 0x3F);
+		stream_append_s8(s, (s8){.len = 2, .s = buf});
+	} else {
+		buf[0] = 0xE0 | (cp >> 12);
+		buf[1] = 0x80 | ((cp >> 6) & 0x3F);
+		buf[2] = 0x80 | (cp & 0x3F);
+		stream_append_s8(s, (s8){.len = 3, .s = buf});
+	}
+}
+
+static void __attribute__((noreturn))
+die(char *msg, char *arg)
+{
+	stream_append_s8(&error_stream, s8("yomigen: "));
+	for (; *msg; msg++) stream_append_byte(&error_stream, *msg);
+	if (arg) for (; *arg; arg++) stream_append_byte(&error_stream, *arg);
+	stream_append_byte(&error_stream, '\n');
+	stream_flush(&error_stream);
+	_exit(1);
+}
+
+/* splitmix64; small, fast and good enough for synthetic data */
+static u64
+rand_u64(u64 *state)
+{
+	u64 z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static u32
+rand_below(u64 *state, u32 n)
+{
+	return (u32)(((rand_u64(state) >> 32) * n) >> 32);
+}
+
+/* NOTE: min of two uniform draws skews toward short lengths like real dictionaries */
+static u32
+rand_range_skewed(u64 *state, Range r)
+{
+	u32 span = r.max - r.min + 1;
+	u32 a = rand_below(state, span), b = rand_below(state, span);
+	return r.min + (a < b ? a : b);
+}
+
+static u32
+rand_range(u64 *state, Range r)
+{
+	return r.min + rand_below(state, r.max - r.min + 1);
+}
+
+static u32
+rand_hiragana(u64 *state)
+{
+	return 0x3041 + rand_below(state, 0x3093 - 0x3041 + 1);
+}
+
+static u32
+rand_term_char(u64 *state)
+{
+	/* NOTE: mostly kanji from a common looking block with some okurigana */
+	if (rand_below(state, 10) < 7) return 0x4E00 + rand_below(state, 3000);
+	else                           return rand_hiragana(state);
+}
+
+static void
+append_glossary(Stream *s, u64 *state, Options *o)
+{
+	u32 nchars = rand_range(state, o->glossary_chars);
+	stream_append_byte(s, '"');
+	for (u32 i = 0; i < nchars; i++) {
+		if (rand_below(state, 1000) < o->escape_permille) {
+			stream_append_s8(s, esc_table[rand_below(state, ARRAY_COUNT(esc_table))]);
+		} else if (rand_below(state, 8) == 0) {
+			stream_append_byte(s, 'a' + rand_below(state, 26));
+		} else {
+			stream_append_codepoint(s, rand_term_char(state));
+		}
+	}
+	stream_append_byte(s, '"');
+}
+
+static void
+append_entry(Stream *bank, Stream *queries, u64 *state, Options *o, u64 seq)
+{
+	stream_append_s8(bank, s8("[\""));
+	u32 term_chars = rand_range_skewed(state, o->term_chars);
+	for (u32 i = 0; i < term_chars; i++) {
+		u32 cp = rand_term_char(state);
+		stream_append_codepoint(bank, cp);
+		stream_append_codepoint(queries, cp);
+	}
+	stream_append_byte(queries, '\n');
+
+	stream_append_s8(bank, s8("\",\""));
+	u32 reading_chars = term_chars + rand_below(state, term_chars + 1);
+	for (u32 i = 0; i < reading_chars; i++)
+		stream_append_codepoint(bank, rand_hiragana(state));
+
+	stream_append_s8(bank, s8("\",\""));
+	stream_append_s8(bank, tag_table[rand_below(state, ARRAY_COUNT(tag_table))]);
+	stream_append_s8(bank, s8("\",\""));
+	stream_append_s8(bank, rule_table[rand_below(state, ARRAY_COUNT(rule_table))]);
+	stream_append_s8(bank, s8("\","));
+	stream_append_i64(bank, rand_below(state, 100));
+
+	stream_append_s8(bank, s8(",["));
+	u32 nglossary = rand_range(state, o->glossary_count);
+	for (u32 i = 0; i < nglossary; i++) {
+		if (i) stream_append_byte(bank, ',');
+		append_glossary(bank, state, o);
+	}
+	stream_append_s8(bank, s8("],"));
+	stream_append_i64(bank, seq);
+	stream_append_s8(bank, s8(",\"\"]"));
+}
+
+static i32
+open_output(char *dir, char *name)
+{
+	i32 dfd = open(dir, O_RDONLY|O_DIRECTORY);
+	if (dfd < 0) die("failed to open: ", dir);
+	i32 fd = openat(dfd, name, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd < 0) die("failed to create: ", name);
+	close(dfd);
+	return fd;
+}
+
+static void
+close_output(Stream *s)
+{
+	stream_flush(s);
+	if (s->errors) die("write failed", 0);
+	close(s->fd);
+}
+
+static b32
+parse_u64(char *arg, u64 *out)
+{
+	u64 result = 0;
+	if (!arg || !*arg) return 0;
+	for (; *arg; arg++) {
+		if (*arg < '0' || *arg > '9') return 0;
+		result = result * 10 + (*arg - '0');
+	}
+	*out = result;
+	return 1;
+}
+
+/* accepts "n" or "min-max" */
+static b32
+parse_range(char *arg, Range *out)
+{
+	char *sep = arg;
+	while (sep && *sep && *sep != '-') sep++;
+
+	u64 min, max;
+	if (sep && *sep == '-') {
+		*sep = 0;
+		if (!parse_u64(arg, &min) || !parse_u64(sep + 1, &max)) return 0;
+	} else {
+		if (!parse_u64(arg, &min)) return 0;
+		max = min;
+	}
+	if (min == 0 || min > max || max > 4096) return 0;
+	out->min = min;
+	out->max = max;
+	return 1;
+}
+
+static void __attribute__((noreturn))
+usage(char *argv0)
+{
+	stream_append_s8(&error_stream, s8("usage: "));
+	for (; *argv0; argv0++) stream_append_byte(&error_stream, *argv0);
+	stream_append_s8(&error_stream, s8(" [-n entries] [-b banks] [-t min-max] [-g min-max] "
+	                                   "[-l min-max] [-e permille] [-s seed] dir\n"));
+	stream_flush(&error_stream);
+	_exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Options o = {
+		.entries         = 10000,
+		.term_chars      = {1, 6},
+		.glossary_count  = {1, 4},
+		.glossary_chars  = {8, 120},
+		.escape_permille = 10,
+		.seed            = 0x3243f6a8885a308d,
+	};
+
+	char *argv0 = argv[0];
+	for (argv++, argc--; argv[0] && argv[0][0] == '-'; argv++, argc--) {
+		if (!argv[1]) usage(argv0);
+		u64 n;
+		b32 ok = 1;
+		switch (argv[0][1]) {
+		case 'n': ok = parse_u64(argv[1], &o.entries) && o.entries; break;
+		case 'b': ok = parse_u64(argv[1], &n) && n && n < 1 << 20; o.banks = n; break;
+		case 's': ok = parse_u64(argv[1], &o.seed);                   break;
+		case 'e': ok = parse_u64(argv[1], &n) && n <= 1000; o.escape_permille = n; break;
+		case 't': ok = parse_range(argv[1], &o.term_chars);           break;
+		case 'g': ok = parse_range(argv[1], &o.glossary_count);       break;
+		case 'l': ok = parse_range(argv[1], &o.glossary_chars);       break;
+		default:  usage(argv0);
+		}
+		if (!ok) die("invalid argument: ", argv[1]);
+		argv++, argc--;
+	}
+	if (argc != 1) usage(argv0);
+	o.outdir = argv[0];
+
+	/* NOTE: yomichan-import writes 10000 entries per bank */
+	if (!o.banks) o.banks = (o.entries + 9999) / 10000;
+	if (o.banks > o.entries) o.banks = o.entries;
+
+	if (mkdir(o.outdir, 0755) < 0 && access(o.outdir, W_OK) < 0)
+		die("failed to create: ", o.outdir);
+
+	Stream *index = &(Stream){.fd = open_output(o.outdir, "index.json")};
+	stream_append_s8(index, s8("{\"title\":\"yomigen\",\"format\":3,\"revision\":\"seed "));
+	stream_append_i64(index, o.seed);
+	stream_append_s8(index, s8("\",\"sequenced\":true}\n"));
+	close_output(index);
+
+	static Stream bank, queries;
+	queries.fd = open_output(o.outdir, "queries.txt");
+
+	u64 state = o.seed, seq = 1;
+	for (u32 b = 0; b < o.banks; b++) {
+		char name[64] = "term_bank_";
+		Stream namebuf = {0};
+		stream_append_i64(&namebuf, b + 1);
+		stream_append_s8(&namebuf, s8(".json"));
+		for (u32 i = 0; i < namebuf.widx; i++) name[10 + i] = namebuf.data[i];
+		name[10 + namebuf.widx] = 0;
+
+		bank.fd = open_output(o.outdir, name);
+		bank.widx = bank.errors = 0;
+
+		u64 count = o.entries / o.banks + (b < o.entries % o.banks);
+		stream_append_byte(&bank, '[');
+		for (u64 i = 0; i < count; i++, seq++) {
+			if (i) stream_append_byte(&bank, ',');
+			append_entry(&bank, &queries, &state, &o, seq);
+		}
+		stream_append_s8(&bank, s8("]\n"));
+		close_output(&bank);
+	}
+	close_output(&queries);
+
+	return 0;
+}
@@ -0,0 +1,465 @@
+/* See LICENSE for license details.
+ *
+ * zip.c implements a reader for the central directory of zip
+ * archives and a DEFLATE decoder. Archives are expected to be in
+ * memory in their entirety and entries are decoded straight into a
+ * caller provided buffer of their uncompressed size. Finding the
+ * archive and allocating memory should be implemented elsewhere.
+ */
+
+#define ZIP_EOCD_SIG      0x06054b50u
+#define ZIP_CENTRAL_SIG   0x02014b50u
+#define ZIP_LOCAL_SIG     0x04034b50u
+#define ZIP_EOCD_SIZE     22
+#define ZIP_CENTRAL_SIZE  46
+#define ZIP_LOCAL_SIZE    30
+#define ZIP_MAX_COMMENT   65535
+
+#define ZIP_METHOD_STORED  0
+#define ZIP_METHOD_DEFLATE 8
+
+/* NOTE: codes up to this length are decoded with a single table lookup */
+#define INFLATE_FAST_BITS 11
+#define INFLATE_FAST_SIZE (1 << INFLATE_FAST_BITS)
+
+enum {
+	ZIP_ERROR_FORMAT = -1,
+	ZIP_ERROR_METHOD = -2,
+	ZIP_ERROR_DATA   = -3,
+};
+
+typedef struct {
+	u8  *data;
+	size len;
+	u8  *central;   /* next central directory record */
+	u32  remaining; /* number of records after central */
+} ZipReader;
+
+typedef struct {
+	u8  *name;
+	u32  name_len;
+	u32  method;
+	u32  compressed_size;
+	u32  size;
+	u32  crc32;
+	u32  local_offset;
+} ZipEntry;
+
+typedef struct {
+	u16 fast[INFLATE_FAST_SIZE];  /* (length << 9) | symbol, 0 if the code is longer */
+	u16 first_code[16];
+	u16 first_symbol[16];
+	u32 max_code[17];             /* first code of each length not in use, left aligned to 16 bits */
+	u8  lengths[288];
+	u16 symbols[288];
+} InflateHuffman;
+
+typedef struct {
+	u8  *src, *src_end;
+	u8  *dst, *dst_beg, *dst_end;
+	u64  bits;
+	u32  nbits;
+	u32  overread;
+	InflateHuffman litlen;
+	InflateHuffman dist;
+} Inflater;
+
+static u32
+zip_u16(u8 *p)
+{
+	return (u32)p[0] | (u32)p[1] << 8;
+}
+
+static u32
+zip_u32(u8 *p)
+{
+	return (u32)p[0] | (u32)p[1] << 8 | (u32)p[2] << 16 | (u32)p[3] << 24;
+}
+
+static i32
+zip_reader_init(ZipReader *z, u8 *data, size len)
+{
+	if (len < ZIP_EOCD_SIZE)
+		return ZIP_ERROR_FORMAT;
+
+	/* NOTE: the end of central directory record is followed by a comment of
+	 * unknown length; search back for its signature */
+	u8 *eocd  = 0;
+	u8 *first = data + len - ZIP_EOCD_SIZE;
+	u8 *last  = len - ZIP_EOCD_SIZE > ZIP_MAX_COMMENT ? first - ZIP_MAX_COMMENT : data;
+	for (u8 *p = first; p >= last; p--) {
+		if (zip_u32(p) == ZIP_EOCD_SIG) {
+			eocd = p;
+			break;
+		}
+	}
+	if (!eocd)
+		return ZIP_ERROR_FORMAT;
+
+	u32 count  = zip_u16(eocd + 10);
+	u32 offset = zip_u32(eocd + 16);
+	if ((size)offset > len)
+		return ZIP_ERROR_FORMAT;
+
+	z->data      = data;
+	z->len       = len;
+	z->central   = data + offset;
+	z->remaining = count;
+	return 0;
+}
+
+/* returns 1 and fills e with the next entry, 0 at the end or on error */
+static i32
+zip_next_entry(ZipReader *z, ZipEntry *e)
+{
+	u8 *p = z->central;
+	if (!z->remaining || p + ZIP_CENTRAL_SIZE > z->data + z->len || zip_u32(p) != ZIP_CENTRAL_SIG)
+		return 0;
+
+	e->method          = zip_u16(p + 10);
+	e->compressed_size = zip_u32(p + 20);
+	e->size            = zip_u32(p + 24);
+	e->crc32           = zip_u32(p + 16);
+	e->name_len        = zip_u16(p + 28);
+	e->local_offset    = zip_u32(p + 42);
+	e->name            = p + ZIP_CENTRAL_SIZE;
+
+	u32 record_size = ZIP_CENTRAL_SIZE + e->name_len + zip_u16(p + 30) + zip_u16(p + 32);
+	if (p + record_size > z->data + z->len)
+		return 0;
+
+	z->central += record_size;
+	z->remaining--;
+	return 1;
+}
+
+static void
+inflate_refill(Inflater *s)
+{
+	if (s->src_end - s->src >= 8) {
+		/* NOTE: load a whole (little endian) word and keep as many bytes of it as fit */
+		u64 word;
+		__builtin_memcpy(&word, s->src, sizeof(word));
+		s->bits  |= word << s->nbits;
+		s->src   += (63 - s->nbits) >> 3;
+		s->nbits |= 56;
+	} else {
+		while (s->nbits <= 56) {
+			u64 byte = 0;
+			if (s->src < s->src_end) byte = *s->src++;
+			else                     s->overread++;
+			s->bits  |= byte << s->nbits;
+			s->nbits += 8;
+		}
+	}
+}
+
+/* NOTE: the caller must have made sure that at least n bits are buffered */
+static u32
+inflate_take(Inflater *s, u32 n)
+{
+	u32 result = s->bits & (((u64)1 << n) - 1);
+	s->bits  >>= n;
+	s->nbits  -= n;
+	return result;
+}
+
+static u32
+inflate_bits(Inflater *s, u32 n)
+{
+	if (s->nbits < n) inflate_refill(s);
+	return inflate_take(s, n);
+}
+
+static u32
+inflate_reverse(u32 code, u32 len)
+{
+	code = ((code & 0xAAAA) >> 1) | ((code & 0x5555) << 1);
+	code = ((code & 0xCCCC) >> 2) | ((code & 0x3333) << 2);
+	code = ((code & 0xF0F0) >> 4) | ((code & 0x0F0F) << 4);
+	code = ((code & 0xFF00) >> 8) | ((code & 0x00FF) << 8);
+	return code >> (16 - len);
+}
+
+static b32
+inflate_build(InflateHuffman *h, u8 *lengths, u32 count)
+{
+	u32 counts[16] = {0}, next_code[16];
+	for (u32 i = 0; i < INFLATE_FAST_SIZE; i++)
+		h->fast[i] = 0;
+	for (u32 i = 0; i < count; i++)
+		counts[lengths[i]]++;
+	counts[0] = 0;
+
+	u32 code = 0, symbol = 0;
+	for (u32 len = 1; len < 16; len++) {
+		next_code[len]       = code;
+		h->first_code[len]   = code;
+		h->first_symbol[len] = symbol;
+		code   += counts[len];
+		symbol += counts[len];
+		if (counts[len] && code - 1 >= (1u << len))
+			return 0;
+		h->max_code[len] = code << (16 - len);
+		code <<= 1;
+	}
+	h->max_code[16] = 0x10000;
+
+	for (u32 i = 0; i < count; i++) {
+		u32 len = lengths[i];
+		if (!len)
+			continue;
+		u32 slot = next_code[len] - h->first_code[len] + h->first_symbol[len];
+		h->lengths[slot] = len;
+		h->symbols[slot] = i;
+		if (len <= INFLATE_FAST_BITS) {
+			for (u32 j = inflate_reverse(next_code[len], len); j < INFLATE_FAST_SIZE; j += 1u << len)
+				h->fast[j] = (len << 9) | i;
+		}
+		next_code[len]++;
+	}
+	return 1;
+}
+
+/* returns the next symbol or -1 for an invalid code; the caller must have made
+ * sure that at least 15 bits are buffered */
+static i32
+inflate_symbol(Inflater *s, InflateHuffman *h)
+{
+	u32 fast = h->fast[s->bits & (INFLATE_FAST_SIZE - 1)];
+	if (fast) {
+		s->bits  >>= fast >> 9;
+		s->nbits  -= fast >> 9;
+		return fast & 511;
+	}
+
+	/* NOTE: codes are stored most significant bit first; compare them left
+	 * aligned against the first unused code of each length */
+	u32 k = inflate_reverse(s->bits & 0xFFFF, 16);
+	u32 len;
+	for (len = INFLATE_FAST_BITS + 1; k >= h->max_code[len]; len++);
+	if (len >= 16)
+		return -1;
+	u32 slot = (k >> (16 - len)) - h->first_code[len] + h->first_symbol[len];
+	if (slot >= 288 || h->lengths[slot] != len)
+		return -1;
+	s->bits  >>= len;
+	s->nbits  -= len;
+	return h->symbols[slot];
+}
+
+static i32
+inflate_decode(Inflater *s, InflateHuffman *h)
+{
+	if (s->nbits < 16) inflate_refill(s);
+	return inflate_symbol(s, h);
+}
+
+static b32
+inflate_fixed_tables(Inflater *s)
+{
+	u8 lengths[288 + 32];
+	u32 i = 0;
+	for (; i < 144; i++) lengths[i] = 8;
+	for (; i < 256; i++) lengths[i] = 9;
+	for (; i < 280; i++) lengths[i] = 7;
+	for (; i < 288; i++) lengths[i] = 8;
+	for (; i < 320; i++) lengths[i] = 5;
+	return inflate_build(&s->litlen, lengths, 288) && inflate_build(&s->dist, lengths + 288, 32);
+}
+
+static b32
+inflate_dynamic_tables(Inflater *s)
+{
+	static u8 order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	u32 nlitlen = inflate_bits(s, 5) + 257;
+	u32 ndist   = inflate_bits(s, 5) + 1;
+	u32 nclen   = inflate_bits(s, 4) + 4;
+
+	u8 clen_lengths[19] = {0};
+	for (u32 i = 0; i < nclen; i++)
+		clen_lengths[order[i]] = inflate_bits(s, 3);
+
+	InflateHuffman clen;
+	if (!inflate_build(&clen, clen_lengths, 19))
+		return 0;
+
+	u8 lengths[288 + 32];
+	u32 n = 0;
+	while (n < nlitlen + ndist) {
+		i32 sym = inflate_decode(s, &clen);
+		if (sym < 0)
+			return 0;
+
+		u32 repeat, value = 0;
+		if (sym < 16) {
+			lengths[n++] = sym;
+			continue;
+		} else if (sym == 16) {
+			if (n == 0)
+				return 0;
+			value  = lengths[n - 1];
+			repeat = 3 + inflate_bits(s, 2);
+		} else if (sym == 17) {
+			repeat = 3 + inflate_bits(s, 3);
+		} else {
+			repeat = 11 + inflate_bits(s, 7);
+		}
+		if (n + repeat > nlitlen + ndist)
+			return 0;
+		while (repeat--)
+			lengths[n++] = value;
+	}
+
+	return inflate_build(&s->litlen, lengths, nlitlen) &&
+	       inflate_build(&s->dist, lengths + nlitlen, ndist);
+}
+
+static b32
+inflate_stored(Inflater *s)
+{
+	/* NOTE: drop to a byte boundary; whole bytes still in the bit buffer are
+	 * handed back to the input */
+	inflate_bits(s, s->nbits & 7);
+	s->src     -= (s->nbits >> 3) - s->overread;
+	s->bits     = s->nbits = s->overread = 0;
+
+	if (s->src_end - s->src < 4)
+		return 0;
+	u32 len  = zip_u16(s->src);
+	u32 nlen = zip_u16(s->src + 2);
+	s->src  += 4;
+	if ((len ^ 0xFFFF) != nlen || s->src_end - s->src < (size)len || s->dst_end - s->dst < (size)len)
+		return 0;
+
+	for (u32 i = 0; i < len; i++)
+		s->dst[i] = s->src[i];
+	s->dst += len;
+	s->src += len;
+	return 1;
+}
+
+static b32
+inflate_codes(Inflater *s)
+{
+	static u16 length_base[29] = {
+		3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+		35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+	};
+	static u8 length_extra[29] = {
+		0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+		3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+	};
+	static u16 dist_base[30] = {
+		1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+		257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+		8193, 12289, 16385, 24577,
+	};
+	static u8 dist_extra[30] = {
+		0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+		7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+	};
+
+	/* NOTE: a refill leaves at least 56 bits buffered which covers the longest
+	 * length/distance pair (15 + 5 + 15 + 13 bits) */
+	u8 *dst = s->dst;
+	for (;;) {
+		if (s->nbits < 48) inflate_refill(s);
+		i32 sym = inflate_symbol(s, &s->litlen);
+		if (sym < 256) {
+			if (sym < 0 || dst == s->dst_end)
+				return 0;
+			*dst++ = sym;
+			continue;
+		}
+		if (sym == 256)
+			break;
+
+		sym -= 257;
+		if (sym >= 29)
+			return 0;
+		u32 len = length_base[sym];
+		if (length_extra[sym]) len += inflate_take(s, length_extra[sym]);
+
+		i32 dsym = inflate_symbol(s, &s->dist);
+		if (dsym < 0 || dsym >= 30)
+			return 0;
+		u32 dist = dist_base[dsym];
+		if (dist_extra[dsym]) dist += inflate_take(s, dist_extra[dsym]);
+		if ((size)dist > dst - s->dst_beg || (size)len > s->dst_end - dst)
+			return 0;
+
+		u8 *from = dst - dist;
+		if (dist >= 8 && s->dst_end - dst >= (size)len + 8) {
+			/* NOTE: copy whole words; overshoot is overwritten by later output */
+			for (u32 i = 0; i < len; i += 8) {
+				u64 word;
+				__builtin_memcpy(&word, from + i, sizeof(word));
+				__builtin_memcpy(dst + i, &word, sizeof(word));
+			}
+			dst += len;
+		} else {
+			while (len--) *dst++ = *from++;
+		}
+	}
+	s->dst = dst;
+	return 1;
+}
+
+/* decodes the raw DEFLATE stream in src into dst; returns the number of bytes
+ * written or ZIP_ERROR_DATA */
+static size
+inflate(u8 *dst, size dst_len, u8 *src, size src_len)
+{
+	Inflater s = {
+		.src = src, .src_end = src + src_len,
+		.dst = dst, .dst_beg = dst, .dst_end = dst + dst_len,
+	};
+
+	u32 final;
+	do {
+		final    = inflate_bits(&s, 1);
+		u32 type = inflate_bits(&s, 2);
+		b32 ok   = 0;
+		switch (type) {
+		case 0: ok = inflate_stored(&s);                              break;
+		case 1: ok = inflate_fixed_tables(&s)   && inflate_codes(&s); break;
+		case 2: ok = inflate_dynamic_tables(&s) && inflate_codes(&s); break;
+		}
+		if (!ok || s.overread > s.nbits / 8)
+			return ZIP_ERROR_DATA;
+	} while (!final);
+
+	return s.dst - dst;
+}
+
+/* decompresses e into dst which must hold e->size bytes; returns e->size or an error */
+static size
+zip_extract(ZipReader *z, ZipEntry *e, u8 *dst)
+{
+	u8 *local = z->data + e->local_offset;
+	if ((size)e->local_offset > z->len - ZIP_LOCAL_SIZE || zip_u32(local) != ZIP_LOCAL_SIG)
+		return ZIP_ERROR_FORMAT;
+
+	u8 *src = local + ZIP_LOCAL_SIZE + zip_u16(local + 26) + zip_u16(local + 28);
+	if (src > z->data + z->len || (size)e->compressed_size > z->data + z->len - src)
+		return ZIP_ERROR_FORMAT;
+
+	size result = ZIP_ERROR_METHOD;
+	switch (e->method) {
+	case ZIP_METHOD_STORED:
+		if (e->compressed_size != e->size)
+			return ZIP_ERROR_FORMAT;
+		for (u32 i = 0; i < e->size; i++)
+			dst[i] = src[i];
+		result = e->size;
+		break;
+	case ZIP_METHOD_DEFLATE:
+		result = inflate(dst, e->size, src, e->compressed_size);
+		if (result >= 0 && result != (size)e->size)
+			result = ZIP_ERROR_DATA;
+		break;
+	}
+	return result;
+}